@@ -11,6 +11,8 @@
 #    - creates skeletons for methods of structs and classes
 #    - creates initialization code for non-pointer members (of known types)
 #    - optional: creates a function that initializes the virtual tables
+#    - creates direct-call wrappers for final methods and for all the methods
+#      of final classes; the calls through a wrapper can be inlined
 #
 # Author: Marko Mahnič
 # Created: March 2011
@@ -157,6 +159,11 @@ class CMethod:
     def __init__(self, name, result, params):
         self.name = name.strip()
         self.result = result.strip()
+        # a final method can not be overridden in derived classes
+        self.final = False
+        if self.result.startswith("final "):
+            self.final = True
+            self.result = self.result[6:].strip()
         if params == None: self.params = None
         else:
             self.params = [ p.strip() for p in params.split(",") ]
@@ -200,6 +207,7 @@ class CClass(object):
         self.fn_prefix = self.name[:4]
         # self.type_name = None
         self.variant = None
+        self.final = False     # a final class can not be inherited
         if options != None:
             self._parse_options(options)
         self.members = []
@@ -214,7 +222,9 @@ class CClass(object):
         iopts = 0
         for opt in options:
             tv = opt.split()
-            if len(tv) == 1:
+            if opt == 'final':
+                self.final = True
+            elif len(tv) == 1:
                 if iopts == 0: self.fn_prefix = opt
                 if iopts == 1: self.type_name = opt
             elif len(tv) == 2:
@@ -250,6 +260,12 @@ class CClass(object):
             print "WARN: Method name too long (%d): %s" % (len(mn), mn)
         return mn
 
+    def direct_call_name(self, name):
+        mn = "%s_%s" % (self.fn_prefix, name)
+        if len(mn) > 31:
+            print "WARN: Direct-call name too long (%d): %s" % (len(mn), mn)
+        return mn
+
     def hasMethod(self, name):
         """True if the method is defined/overridden in this class."""
         for m in self.methods:
@@ -282,6 +298,28 @@ class CClass(object):
         for m in self.members:
             m.resolve_type()
 
+    def find_final_method(self, name):
+        """The class that declares the method final, or None."""
+        for m in self.methods:
+            if m.name == name and m.final: return self
+        if self.baseClass != None:
+            return self.baseClass.find_final_method(name)
+        return None
+
+    # called after the types are resolved; returns the number of errors
+    def check_final(self):
+        errors = 0
+        if self.baseClass != None and self.baseClass.final:
+            print "ERROR: %s: The base class %s is final" % (self.name, self.baseClass.name)
+            errors += 1
+        if self.baseClass != None:
+            for m in self.methods:
+                c = self.baseClass.find_final_method(m.name)
+                if c != None:
+                    print "ERROR: %s: Method %s is final in %s" % (self.name, m.name, c.name)
+                    errors += 1
+        return errors
+
     def dump_forward_decl(self, writer):
         if self.variant:
             writer.writeln("#ifdef %s" % self.variant)
@@ -335,6 +373,25 @@ class CClass(object):
                 methods.append([m, self])
         return methods
 
+    # The wrappers call the implementation directly instead of through the
+    # vtable.  They are created for final methods and for all the methods of a
+    # final class.
+    def dump_direct_calls(self, writer):
+        for pair in self.get_vt_methods():
+            m, owner = pair
+            if m.name == "init": continue
+            if not (self.final or (m.final and owner == self and self.hasMethod(m.name))):
+                continue
+            params = ["void* _%s" % self.thisname] + m.body_args
+            params = [p.strip() for p in params if p.strip() != ""]
+            args = [p.split()[-1].lstrip("*") for p in params]
+            ret = "" if m.body_type == "void" else "return "
+            writer.writeln("    static OOC_INLINE %s\n%s(%s)" % (m.body_type,
+                self.direct_call_name(m.name), ", ".join(params)))
+            writer.writeln("{")
+            writer.writeln("%s%s(%s);" % (ret, owner.method_name(m.name), ", ".join(args)))
+            writer.writeln("}")
+
     def dump_vtable_static_init(self, writer):
         writer.writeln("static %s %s = {" % (self.class_type, self.class_vtable))
         vt = self.get_vt_methods()
@@ -490,6 +547,7 @@ class CClass(object):
         # method headers
         self.dump_method_decls(IMPL)
         IMPL.writeln("")
+        self.dump_direct_calls(IMPL)
 
         # initialization
         if STATIC_VT_INIT:
@@ -673,6 +731,8 @@ lines += open("popuplst.c", "r").readlines()
 lines += open("puls_pb.c", "r").readlines()
 lines += open("puls_pm.c", "r").readlines()
 lines += open("puls_pq.c", "r").readlines()
+lines += open("puls_pf.c", "r").readlines()
+lines += open("puls_pl.c", "r").readlines()
 lines += open("puls_tw.c", "r").readlines()
 
 HDR  = CFileWriter("popupls_.h")
@@ -699,6 +759,15 @@ HDR.writeln("""
 #define offsetof(st, m) \\
      ((size_t) ( (char *)&((st *)(0))->m - (char *)0 ))
 #endif
+#ifndef OOC_INLINE
+# if defined(__GNUC__)
+#  define OOC_INLINE __inline__
+# elif defined(_MSC_VER)
+#  define OOC_INLINE __inline
+# else
+#  define OOC_INLINE
+# endif
+#endif
 """)
 
 i = 0
@@ -713,6 +782,12 @@ while i < len(lines):
 for c in classes:
     c.resolve_types()
 
+errors = 0
+for c in classes:
+    errors += c.check_final()
+if errors > 0:
+    sys.exit(1)
+
 for c in consts:
     c.dump(HDR)
 HDR.writeln("")
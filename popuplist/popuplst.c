@@ -42,6 +42,13 @@
 #define ADVANCE_CHAR_P(p) ++p
 #endif
 
+/* _stristr uses SSE2 and, if the CPU supports it, AVX2 */
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__)) \
+	&& (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define PULS_SIMD_STRISTR
+#include <immintrin.h>
+#endif
+
 /* HACK from eval.c */
 static dictitem_T dumdi;
 #define DI2HIKEY(di) ((di)->di_key)
@@ -146,6 +153,181 @@ limit_value(value, vmin, vmax)
     return value;
 }
 
+/* The time in milliseconds from an unspecified start; only the differences
+ * are meaningful. */
+    static long_u
+_clock_ms()
+{
+#if defined(WIN3264)
+    return (long_u) GetTickCount();
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long_u) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+/*
+ * Search for needle in haystack, ignoring case, starting at offset start.
+ * hs and ns are the lengths of the strings, hs >= ns.
+ */
+    static char_u*
+_stristr_from(haystack, hs, needle, ns, start)
+    char_u* haystack;
+    int	    hs;
+    char_u* needle;
+    int	    ns;
+    int	    start;
+{
+    char_u* p;
+    char_u* pend;
+    int	    c;
+
+    if (ns < 1)
+	return haystack + start;
+
+    c = TOLOWER_LOC(*needle);
+    pend = haystack + hs - ns;
+    for (p = haystack + start; p <= pend; p++)
+    {
+	if (TOLOWER_LOC(*p) == c && 0 == STRNICMP(p, needle, ns))
+	    return p;
+    }
+
+    return NULL;
+}
+
+    static char_u*
+_stristr_scalar(haystack, hs, needle, ns)
+    char_u* haystack;
+    int	    hs;
+    char_u* needle;
+    int	    ns;
+{
+    return _stristr_from(haystack, hs, needle, ns, 0);
+}
+
+#ifdef PULS_SIMD_STRISTR
+/*
+ * The SIMD versions compare a block of positions at once with the first and
+ * the last character of needle in both cases. Only the positions where both
+ * characters match are compared with STRNICMP. The last block overlaps the
+ * previous one so that short strings don't fall back to the scalar version.
+ */
+    static char_u*
+_stristr_sse2(haystack, hs, needle, ns)
+    char_u* haystack;
+    int	    hs;
+    char_u* needle;
+    int	    ns;
+{
+    __m128i first_lo, first_up, last_lo, last_up, bfirst, blast;
+    unsigned int bits;
+    int i, k, npos, done;
+
+    npos = hs - ns + 1; /* the number of positions where needle can start */
+    if (npos < 16)
+	return _stristr_from(haystack, hs, needle, ns, 0);
+
+    first_lo = _mm_set1_epi8((char)TOLOWER_ASC(needle[0]));
+    first_up = _mm_set1_epi8((char)TOUPPER_ASC(needle[0]));
+    last_lo = _mm_set1_epi8((char)TOLOWER_ASC(needle[ns-1]));
+    last_up = _mm_set1_epi8((char)TOUPPER_ASC(needle[ns-1]));
+    for (i = 0; i < npos; i += 16)
+    {
+	done = 0;
+	if (i + 16 > npos)
+	{
+	    done = i - (npos - 16); /* already checked in the previous block */
+	    i = npos - 16;
+	}
+	bfirst = _mm_loadu_si128((__m128i*)(haystack + i));
+	blast = _mm_loadu_si128((__m128i*)(haystack + i + ns - 1));
+	bits = _mm_movemask_epi8(_mm_and_si128(
+		    _mm_or_si128(_mm_cmpeq_epi8(bfirst, first_lo), _mm_cmpeq_epi8(bfirst, first_up)),
+		    _mm_or_si128(_mm_cmpeq_epi8(blast, last_lo), _mm_cmpeq_epi8(blast, last_up))));
+	if (done)
+	    bits &= ~0U << done;
+	while (bits)
+	{
+	    k = __builtin_ctz(bits);
+	    if (0 == STRNICMP(haystack + i + k, needle, ns))
+		return haystack + i + k;
+	    bits &= bits - 1;
+	}
+    }
+
+    return NULL;
+}
+
+    __attribute__((target("avx2"))) static char_u*
+_stristr_avx2(haystack, hs, needle, ns)
+    char_u* haystack;
+    int	    hs;
+    char_u* needle;
+    int	    ns;
+{
+    __m256i first_lo, first_up, last_lo, last_up, bfirst, blast;
+    unsigned int bits;
+    int i, k, npos, done;
+
+    npos = hs - ns + 1;
+    if (npos < 32)
+	return _stristr_sse2(haystack, hs, needle, ns);
+
+    first_lo = _mm256_set1_epi8((char)TOLOWER_ASC(needle[0]));
+    first_up = _mm256_set1_epi8((char)TOUPPER_ASC(needle[0]));
+    last_lo = _mm256_set1_epi8((char)TOLOWER_ASC(needle[ns-1]));
+    last_up = _mm256_set1_epi8((char)TOUPPER_ASC(needle[ns-1]));
+    for (i = 0; i < npos; i += 32)
+    {
+	done = 0;
+	if (i + 32 > npos)
+	{
+	    done = i - (npos - 32);
+	    i = npos - 32;
+	}
+	bfirst = _mm256_loadu_si256((__m256i*)(haystack + i));
+	blast = _mm256_loadu_si256((__m256i*)(haystack + i + ns - 1));
+	bits = (unsigned int) _mm256_movemask_epi8(_mm256_and_si256(
+		    _mm256_or_si256(_mm256_cmpeq_epi8(bfirst, first_lo), _mm256_cmpeq_epi8(bfirst, first_up)),
+		    _mm256_or_si256(_mm256_cmpeq_epi8(blast, last_lo), _mm256_cmpeq_epi8(blast, last_up))));
+	if (done)
+	    bits &= ~0U << done;
+	while (bits)
+	{
+	    k = __builtin_ctz(bits);
+	    if (0 == STRNICMP(haystack + i + k, needle, ns))
+		return haystack + i + k;
+	    bits &= bits - 1;
+	}
+    }
+
+    return NULL;
+}
+#endif
+
+typedef char_u* (*StrIStr_Fn)(char_u* haystack, int hs, char_u* needle, int ns);
+static StrIStr_Fn _stristr_fn = NULL;
+
+/*
+ * Select the fastest implementation of _stristr for this CPU. Called from
+ * the main thread before the matchers are used.
+ */
+    static void
+_stristr_select()
+{
+    if (_stristr_fn)
+	return;
+    _stristr_fn = &_stristr_scalar;
+#ifdef PULS_SIMD_STRISTR
+    _stristr_fn = &_stristr_sse2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+	_stristr_fn = &_stristr_avx2;
+#endif
+}
+
 /*
  * Search for needle in haystack, ignoring case.
  * Doesn't work for multi-byte characters.
@@ -155,23 +337,18 @@ _stristr(haystack, needle)
     char_u* haystack;
     char_u* needle;
 {
-    char_u* p;
     int hs = STRLEN(haystack);
     int ns = STRLEN(needle);
     if (hs < ns)
 	return NULL;
 
-    hs -= ns;
-    p = haystack;
-    while (hs >= 0)
-    {
-	if (0 == STRNICMP(p, needle, ns))
-	    return p;
-	p++;
-	hs--;
-    }
+    /* The SIMD versions fold only the case of ASCII characters. */
+    if (ns < 1 || needle[0] >= 0x80 || needle[ns-1] >= 0x80)
+	return _stristr_from(haystack, hs, needle, ns, 0);
 
-    return NULL;
+    if (! _stristr_fn)
+	_stristr_select();
+    return (*_stristr_fn)(haystack, hs, needle, ns);
 }
 
     static void
@@ -204,6 +381,82 @@ _str_free(str)
     *str = NULL;
 }
 
+/*
+ * Copy src to dst and fold the case of the characters exactly like _stristr
+ * and STRNICMP do: byte by byte with TOLOWER_LOC. A match in the folded text
+ * is then also a match in src, at the same offset. dst must have room for
+ * STRLEN(src) + 1 bytes; dst may be src. If dst is NULL, src is only checked.
+ * @returns TRUE if any character was changed.
+ */
+    static int
+_str_fold(dst, src)
+    char_u* dst;
+    char_u* src;
+{
+    int changed = 0;
+    int c;
+
+    while (*src)
+    {
+	c = TOLOWER_LOC(*src);
+	if (c != *src)
+	{
+	    if (! dst)
+		return TRUE;
+	    changed = 1;
+	}
+	if (dst)
+	    *dst++ = c;
+	++src;
+    }
+    if (dst)
+	*dst = NUL;
+    return changed;
+}
+
+static long_u _char_mask_bits[256];
+static int _char_mask_ready = 0;
+
+/*
+ * The characters in text as a set of bits. ASCII letters are folded to lower
+ * case; digits and letters have their own bits if long_u has 64 bits, other
+ * characters share the remaining bits. A string can contain another string
+ * (ignoring case) only if its mask covers the mask of the other string.
+ */
+    static long_u
+_str_char_mask(text)
+    char_u* text;
+{
+    long_u mask;
+    int c, bit;
+
+    if (! _char_mask_ready)
+    {
+	for (c = 0; c < 256; c++)
+	{
+	    if (c >= 'a' && c <= 'z')
+		bit = c - 'a';
+	    else if (c >= 'A' && c <= 'Z')
+		bit = c - 'A';
+	    else if (c >= '0' && c <= '9')
+		bit = 26 + c - '0';
+	    else if (c >= 0x80)
+		bit = 63;
+	    else
+		bit = 36 + c % 27;
+	    _char_mask_bits[c] = (long_u)1 << (bit % (sizeof(long_u) * 8));
+	}
+	_char_mask_ready = 1;
+    }
+
+    mask = 0;
+    if (! text)
+	return mask;
+    while (*text)
+	mask |= _char_mask_bits[*text++];
+    return mask;
+}
+
 /* Attribute intialization. Use custom names for the popup list.
  * If a name doesn't exist in the syntax table, use PUM values. */
 typedef struct _puls_hl_attrs_T {
@@ -282,6 +535,24 @@ _update_hl_attrs()
 #undef FEAT_POPUPLIST_MENUS
 #endif
 
+/* The items of large lists are scored in multiple threads (link with -lpthread) */
+#if defined(FEAT_POPUPLIST_THREADS) && !defined(UNIX)
+#undef FEAT_POPUPLIST_THREADS
+#endif
+#ifdef FEAT_POPUPLIST_THREADS
+#include <pthread.h>
+#endif
+
+/* The "filelist" provider maps the file with mmap() */
+#if defined(FEAT_POPUPLIST_FILELIST) && !defined(UNIX)
+#undef FEAT_POPUPLIST_FILELIST
+#endif
+
+/* The "files" provider walks the directories in worker threads */
+#if defined(FEAT_POPUPLIST_FILES) && !defined(FEAT_POPUPLIST_THREADS)
+#undef FEAT_POPUPLIST_FILES
+#endif
+
 #include "popupls_.ci" /* created by mmoocc.py from class definitions in [ooc] blocks */
 #include "puls_st.c"
 #include "puls_tw.c"
@@ -484,6 +755,7 @@ _cmdque_pop(_self)
   const ITEM_SEPARATOR		= 0x10;
   const ITEM_CONTEXT_FORWARD	= 0x20;
   const ITEM_CONTEXT_BACK	= 0x40;
+  const ITEM_ARENA		= 0x80;	// the text is in ItemProvider::strings
   struct PopupItem [ppit]
   {
     void*	data; // additional data for the item
@@ -496,10 +768,29 @@ _cmdque_pop(_self)
     ushort	filter_length;
     ushort	filter_parent_score; // for title items (up to 64k titles should be enough)
     ulong	filter_score;
+    long_u	char_mask;  // _str_char_mask() of text, used to reject items before matching
+    char_u*	folded;	    // _str_fold() of text, in ItemProvider::strings; NULL if not cached
+
+    // The display widths in cells, measured by ItemProvider::get_max_widths.
+    short	width;	    // the whole display text; -1 if not measured
+    short	width0;	    // the text before the first tab; the whole text if there is no tab
+    short	width1;	    // the text after the first tab; 0 if there is no tab
 
     void	init();
     void	destroy();
   };
+
+  // The data that the filter needs to score an item. An array of these is
+  // filled by ItemProvider::get_filter_data for a range of items.
+  struct FilterData [fltdat]
+  {
+    PopupItem*	item;
+    char_u*	text;	    // get_filter_text(); may be NULL
+    char_u*	folded;	    // the case-folded text with the same offsets; NULL if not cached
+    uint	flags;
+    long_u	char_mask;  // _str_char_mask() of text; all bits set if unknown
+    void	init();
+  };
 */
 
     static void
@@ -514,6 +805,11 @@ _ppit_init(_self)
     self->filter_length	= 65535; /* assume NUL terminated string */
     self->filter_score	= 1;
     self->filter_parent_score = 0;
+    self->char_mask	= ~(long_u)0; /* unknown; never rejected */
+    self->folded	= NULL;
+    self->width		= -1;
+    self->width0	= 0;
+    self->width1	= 0;
     END_METHOD;
 }
 
@@ -522,7 +818,7 @@ _ppit_destroy(_self)
     void* _self;
     METHOD(PopupItem, destroy);
 {
-    if (self->text && !(self->flags & ITEM_SHARED))
+    if (self->text && !(self->flags & (ITEM_SHARED | ITEM_ARENA)))
     {
 	vim_free(self->text);
 	self->text = NULL;
@@ -530,42 +826,95 @@ _ppit_destroy(_self)
     END_DESTROY(PopupItem);
 }
 
+    static void
+_fltdat_init(_self)
+    void* _self;
+    METHOD(FilterData, init);
+{
+    self->item = NULL;
+    self->text = NULL;
+    self->folded = NULL;
+    self->flags = 0;
+    self->char_mask = ~(long_u)0;
+    END_METHOD;
+}
+
 /* [ooc]
  *
   class ItemProvider(object) [iprov]
   {
     SegmentedGrowArray* items;
+    StringArena*	strings;   // the texts of the items appended with ITEM_ARENA
+    // @var fold_cache: store the case-folded text of the items when they are
+    // appended so that the matchers don't fold it for every search.
+    int			fold_cache;
     dict_T*		commands;  // commands defined in vim-script
     char_u*		title;
     int			has_title_items;
     int			has_shortcuts;
     int			out_of_sync;  // if TRUE, the popup-items have to be updated
+    int			revision;     // changed every time the list of items changes
+    int			base_revision; // changed when the items are removed or reordered, not when they are appended
     NotificationList    title_obsrvrs;
 
+    // @var producing is TRUE while produce_items can append more items. A
+    // provider that builds its items slowly sets it in on_start and the event
+    // loop calls produce_items when there is no input.
+    int			producing;
+
+    // The widest display texts of the items [0, _widths_count); the items
+    // that are appended later are measured in get_max_widths.
+    int			_widths_count;
+    int			_max_width;
+    int			_max_width0;
+    int			_max_width1;
+
     void	init();
     void	destroy();
     void	read_options(dict_T* options);
     void	on_start();	    // called before the items are displayed for the first time
     void	clear_items();
     void	sync_items();       // to be called when out_of_sync is TRUE
+
+    // Append the next batch of items, spending about msec milliseconds.
+    // Clears producing when there are no more items.
+    // @returns the number of items appended
+    int		produce_items(long msec);
     int		get_item_count();
     PopupItem_T* get_item(int item);
 
     // Values returned by append_pchar_item should be considered temporary!
     // @param shared=0 => will be free()-d
+    // @param shared=ITEM_ARENA => a copy of text is stored in strings; it is
+    //    freed with all the others in clear_items()
     PopupItem_T* append_pchar_item(char_u* text, int shared);
+    void	_fold_item_text(PopupItem_T* pitem);
     char_u*	get_display_text(int item);
 
     // Filternig can be implemented with a separate string or with a
     // pointer into the original string and the size of the substring.
     // The part of the string to be filtered is contiguous.
     char_u*	get_filter_text(int item);
+
+    // Fill data for count items starting with first; the filter uses this
+    // instead of get_item, get_filter_text and has_flag in the scoring loops.
+    // A provider that redefines get_filter_text or has_flag should also
+    // redefine get_filter_data; otherwise the slow generic version is used.
+    // @returns the number of items filled
+    int		get_filter_data(int first, int count, FilterData* data);
     char_u*	get_path_text();
     char_u*	get_title();
     void	set_title(char_u* title);
     void	set_marked(int item, int marked);
     uint	has_flag(int item, uint flag);
 
+    // Get the largest display widths of the items [0, count); count<0 - all
+    // items. The measuring stops when width reaches limit and width0 reaches
+    // limit0; limit<=0 - no limit. See PopupItem::width.
+    void	get_max_widths(int count, int limit, int limit0, int* width, int* width0, int* width1);
+    PopupItem*	measure_item(int item); // the item with valid widths or NULL
+    void	_reset_max_widths();
+
     // select_item()
     // @returns:
     //	 0 - let the caller handle it
@@ -609,9 +958,15 @@ _iprov_init(_self)
     self->commands = NULL;
     self->title = NULL;
     self->items = new_SegmentedGrowArrayP(sizeof(PopupItem_T), &_ppit_destroy);
+    self->strings = new_StringArena();
+    self->fold_cache = 1;
     self->has_title_items = 0;
     self->has_shortcuts = 0;
     self->out_of_sync = 0;
+    self->revision = 0;
+    self->base_revision = 0;
+    self->producing = 0;
+    self->op->_reset_max_widths(self);
     END_METHOD;
 }
 
@@ -627,6 +982,7 @@ _iprov_destroy(_self)
     _str_free(&self->title);
 
     CLASS_DELETE(self->items);
+    CLASS_DELETE(self->strings);
 
     END_DESTROY(ItemProvider);
 }
@@ -646,6 +1002,13 @@ _iprov_read_options(_self, options)
     dict_T* options;
     METHOD(ItemProvider, read_options);
 {
+    dictitem_T* option;
+
+    /* set before the items are listed; the items that are already listed
+     * keep their cache */
+    option = dict_find(options, VSTR("fold_cache"), -1L);
+    if (option && option->di_tv.v_type == VAR_NUMBER)
+	self->fold_cache = option->di_tv.vval.v_number ? 1 : 0;
     END_METHOD;
 }
 
@@ -664,6 +1027,10 @@ _iprov_clear_items(_self)
 {
     /* clear deletes cached text from items */
     self->items->op->clear(self->items);
+    strar_clear(self->strings);
+    self->op->_reset_max_widths(self);
+    ++self->revision;
+    ++self->base_revision;
     END_METHOD;
 }
 
@@ -675,6 +1042,17 @@ _iprov_sync_items(_self)
     END_METHOD;
 }
 
+    static int
+_iprov_produce_items(_self, msec)
+    void* _self;
+    long msec;
+    METHOD(ItemProvider, produce_items);
+{
+    self->producing = 0;
+    return 0;
+    END_METHOD;
+}
+
     static int
 _iprov_get_item_count(_self)
     void* _self;
@@ -692,7 +1070,7 @@ _iprov_get_item(_self, item)
 {
     if (item < 0 || item >= self->items->len)
 	return NULL;
-    return (PopupItem_T*) (self->items->op->get_item(self->items, item));
+    return (PopupItem_T*) (sgarr_get_item(self->items, item));
     END_METHOD;
 }
 
@@ -704,12 +1082,24 @@ _iprov_append_pchar_item(_self, text, shared)
     METHOD(ItemProvider, append_pchar_item);
 {
     PopupItem_T* pitnew;
-    pitnew = self->items->op->get_new_item(self->items);
+    if (shared == ITEM_ARENA)
+    {
+	text = strar_save(self->strings, text);
+	if (! text)
+	    return NULL;
+    }
+    pitnew = sgarr_get_new_item(self->items);
+    ++self->revision;
     if (pitnew)
     {
 	init_PopupItem(pitnew);
 	pitnew->text = text;
-	if (shared)
+	pitnew->char_mask = _str_char_mask(text);
+	if (self->fold_cache && text)
+	    self->op->_fold_item_text(self, pitnew);
+	if (shared == ITEM_ARENA)
+	    pitnew->flags |= ITEM_ARENA;
+	else if (shared)
 	    pitnew->flags |= ITEM_SHARED;
 	return pitnew;
     }
@@ -717,6 +1107,27 @@ _iprov_append_pchar_item(_self, text, shared)
     END_METHOD;
 }
 
+/*
+ * Cache the case-folded text of the item. Text that doesn't change when it is
+ * folded is not copied.
+ */
+    static void
+_iprov__fold_item_text(_self, pitem)
+    void* _self;
+    PopupItem_T* pitem;
+    METHOD(ItemProvider, _fold_item_text);
+{
+    if (! _str_fold(NULL, pitem->text))
+    {
+	pitem->folded = pitem->text;
+	return;
+    }
+    pitem->folded = strar_save(self->strings, pitem->text);
+    if (pitem->folded)
+	_str_fold(pitem->folded, pitem->folded);
+    END_METHOD;
+}
+
     static char_u*
 _iprov_get_display_text(_self, item)
     void* _self;
@@ -724,7 +1135,7 @@ _iprov_get_display_text(_self, item)
     METHOD(ItemProvider, get_display_text);
 {
     PopupItem_T* pit;
-    pit = self->items->op->get_item(self->items, item);
+    pit = sgarr_get_item(self->items, item);
     return pit ? pit->text : NULL;
     END_METHOD;
 }
@@ -736,13 +1147,67 @@ _iprov_get_filter_text(_self, item)
     METHOD(ItemProvider, get_filter_text);
 {
     PopupItem_T* pit;
-    pit = self->items->op->get_item(self->items, item);
+    pit = sgarr_get_item(self->items, item);
     if (!pit || !pit->text)
 	return NULL;
     return pit->text + pit->filter_start;
     END_METHOD;
 }
 
+    static int
+_iprov_get_filter_data(_self, first, count, data)
+    void* _self;
+    int first;
+    int count;
+    FilterData_T* data;
+    METHOD(ItemProvider, get_filter_data);
+{
+    SegmentedGrowArray_T* items = self->items;
+    PopupItem_T* pit;
+    FilterData_T* pd;
+    int i, n;
+
+    if (first < 0 || count < 1 || first >= items->len)
+	return 0;
+    if (count > items->len - first)
+	count = items->len - first;
+
+    if (self->op->get_filter_text != &_iprov_get_filter_text
+	    || self->op->has_flag != &_iprov_has_flag)
+    {
+	/* the provider redefines the access to the items */
+	for (i = 0, pd = data; i < count; i++, pd++)
+	{
+	    pd->item = self->op->get_item(self, first + i);
+	    pd->text = self->op->get_filter_text(self, first + i);
+	    pd->folded = NULL;
+	    pd->flags = self->op->has_flag(self, first + i, ~(uint)0);
+	    pd->char_mask = ~(long_u)0;
+	}
+	return count;
+    }
+
+    /* walk the segments directly */
+    pd = data;
+    for (i = first; i < first + count; )
+    {
+	pit = (PopupItem_T*) SGARR_ITEM_AT(items, i);
+	n = items->segment_len - (i & items->segment_mask);
+	if (n > first + count - i)
+	    n = first + count - i;
+	for (i += n; n > 0; --n, ++pit, ++pd)
+	{
+	    pd->item = pit;
+	    pd->text = pit->text ? pit->text + pit->filter_start : NULL;
+	    pd->folded = pit->folded ? pit->folded + pit->filter_start : NULL;
+	    pd->flags = pit->flags;
+	    pd->char_mask = pit->char_mask;
+	}
+    }
+    return count;
+    END_METHOD;
+}
+
     static char_u*
 _iprov_get_path_text(_self)
     void* _self;
@@ -772,6 +1237,102 @@ _iprov_set_title(_self, title)
     END_METHOD;
 }
 
+/*
+ * The widths of the items are measured only once, so resizing a list that
+ * didn't change doesn't have to look at the items. When the limits are
+ * reached the rest of the items is not measured: a wider item wouldn't
+ * change the size of a list that is already as wide as it can be.
+ */
+    static void
+_iprov_get_max_widths(_self, count, limit, limit0, width, width0, width1)
+    void* _self;
+    int count;
+    int limit;
+    int limit0;
+    int* width;
+    int* width0;
+    int* width1;
+    METHOD(ItemProvider, get_max_widths);
+{
+    PopupItem_T* pit;
+    int i, item_count;
+
+    item_count = self->op->get_item_count(self);
+    if (count < 0 || count > item_count)
+	count = item_count;
+    for (i = self->_widths_count; i < count; i++)
+    {
+	if (limit > 0 && self->_max_width >= limit && self->_max_width0 >= limit0)
+	    break;
+	pit = self->op->measure_item(self, i);
+	if (! pit)
+	    continue;
+	if (self->_max_width < pit->width)
+	    self->_max_width = pit->width;
+	if (self->_max_width0 < pit->width0)
+	    self->_max_width0 = pit->width0;
+	if (self->_max_width1 < pit->width1)
+	    self->_max_width1 = pit->width1;
+    }
+    if (self->_widths_count < i)
+	self->_widths_count = i;
+
+    *width = self->_max_width;
+    *width0 = self->_max_width0;
+    *width1 = self->_max_width1;
+    END_METHOD;
+}
+
+    static PopupItem_T*
+_iprov_measure_item(_self, item)
+    void* _self;
+    int item;
+    METHOD(ItemProvider, measure_item);
+{
+    PopupItem_T* pitem;
+    char_u *text, *pos;
+    int w, w0, w1;
+
+    pitem = self->op->get_item(self, item);
+    if (! pitem || pitem->width >= 0)
+	return pitem;
+
+    text = self->op->get_display_text(self, item);
+    w = text ? vim_strsize(text) : 0;
+    pos = text ? vim_strchr(text, '\t') : NULL;
+    if (pos)
+    {
+	w0 = vim_strnsize(text, (int)(pos - text));
+	w1 = vim_strsize(pos + 1);
+    }
+    else
+    {
+	w0 = w;
+	w1 = 0;
+    }
+    pitem->width = w < 0x7fff ? w : 0x7fff;
+    pitem->width0 = w0 < 0x7fff ? w0 : 0x7fff;
+    pitem->width1 = w1 < 0x7fff ? w1 : 0x7fff;
+    return pitem;
+    END_METHOD;
+}
+
+/*
+ * Forget the largest widths when the items are removed or reordered. The
+ * widths stored in the remaining items are reused.
+ */
+    static void
+_iprov__reset_max_widths(_self)
+    void* _self;
+    METHOD(ItemProvider, _reset_max_widths);
+{
+    self->_widths_count = 0;
+    self->_max_width = 0;
+    self->_max_width0 = 0;
+    self->_max_width1 = 0;
+    END_METHOD;
+}
+
     static void
 _iprov_set_marked(_self, item, marked)
     void* _self;
@@ -780,7 +1341,7 @@ _iprov_set_marked(_self, item, marked)
     METHOD(ItemProvider, set_marked);
 {
     PopupItem_T* pit;
-    pit = self->items->op->get_item(self->items, item);
+    pit = sgarr_get_item(self->items, item);
     if (!pit)
 	return;
     if (marked) pit->flags |= ITEM_MARKED;
@@ -796,7 +1357,7 @@ _iprov_has_flag(_self, item, flag)
     METHOD(ItemProvider, has_flag);
 {
     PopupItem_T* pit;
-    pit = self->items->op->get_item(self->items, item);
+    pit = sgarr_get_item(self->items, item);
     if (!pit)
 	return 0;
 
@@ -1005,6 +1566,10 @@ _iprov_sort_items(_self, cmp)
 	return 0;
 
     self->items->op->sort(self->items, cmp);
+    /* the measured items are not at the start any more; their widths are kept */
+    self->op->_reset_max_widths(self);
+    ++self->revision;
+    ++self->base_revision;
     return 1;
     END_METHOD;
 }
@@ -1149,12 +1714,12 @@ _vlprov__cache_list_item(_self, pitem)
 	    break;
 	case VAR_NUMBER:
 	    vim_snprintf((char *)numbuf, NUMBUFLEN, "%d", pitem->li_tv.vval.v_number);
-	    pit = self->op->append_pchar_item(self, vim_strsave(numbuf), !ITEM_SHARED);
+	    pit = self->op->append_pchar_item(self, numbuf, ITEM_ARENA);
 	    break;
 #ifdef FEAT_FLOAT
 	case VAR_FLOAT:
 	    vim_snprintf((char *)numbuf, NUMBUFLEN, "%g", pitem->li_tv.vval.v_float);
-	    pit = self->op->append_pchar_item(self, vim_strsave(numbuf), !ITEM_SHARED);
+	    pit = self->op->append_pchar_item(self, numbuf, ITEM_ARENA);
 	    break;
 #endif
 	case VAR_LIST:
@@ -1180,11 +1745,16 @@ _vlprov_sync_items(_self)
 
     /* clear the items but keep the allocated space */
     self->items->op->clear_contents(self->items);
+    strar_clear(self->strings);
+    self->op->_reset_max_widths(self);
     self->has_title_items = 0;
+    ++self->revision;
+    ++self->base_revision;
 
     if (vimlist)
     {
 	listitem_T *pitem;
+	self->items->op->size_hint(self->items, vimlist->lv_len);
 	for (pitem = vimlist->lv_first; pitem != NULL; pitem = pitem->li_next)
 	    self->op->_cache_list_item(self, pitem);
     }
@@ -1378,6 +1948,14 @@ _vlprov_get_display_text(_self, item)
 #include "puls_pq.c"
 #endif
 
+#if defined(FEAT_POPUPLIST_FILES)
+#include "puls_pf.c"
+#endif
+
+#if defined(FEAT_POPUPLIST_FILELIST)
+#include "puls_pl.c"
+#endif
+
 /* [ooc]
  *
   struct Box [box] {
@@ -1564,7 +2142,11 @@ _lned_backspace(_self)
     char_u  mode_char; // a character to display in the border, identifies the matcher
     char_u* _needle;
     int	    _need_strlen;
+    char_u* _folded_needle; // _str_fold() of _needle
     ulong   empty_score; // score for empty needle, default is 1
+    // Every haystack that matches the needle contains these characters
+    // (_str_char_mask). Set in set_search_str; 0 if nothing is required.
+    long_u  char_mask;
     void    init();
     void    destroy();
 
@@ -1573,10 +2155,24 @@ _lned_backspace(_self)
     // @returns the score of the match or 0 when needle is not in haystack
     ulong   match(char_u* haystack);
 
+    // Same as match, but the matcher may search the case-folded haystack
+    // (_str_fold) instead. folded may be NULL.
+    ulong   match_folded(char_u* folded, char_u* haystack);
+
     // Init data for the highligter
     void    init_highlight(char_u* haystack);
     // @returns the length of the match (to be highlighted)
     int     get_match_at(char_u* haystack);
+
+    // @returns TRUE if every item that matches the needle also matches all
+    // the prefixes of the needle. The filter can then narrow the previous
+    // result instead of scanning all the items when the needle is extended.
+    int     is_monotonic();
+
+    // @returns a new matcher with the same settings and needle that can be
+    // used in another thread, or NULL if the matcher is not thread-safe.
+    // Every subclass must override it.
+    TextMatcher* clone();
   };
  */
 
@@ -1586,9 +2182,12 @@ _txm_init(_self)
     METHOD(TextMatcher, init);
 {
     self->mode_char = 'S'; /* simple */
+    _stristr_select(); /* before the matcher is used in a thread */
     self->_needle = NULL;
     self->_need_strlen = 0;
+    self->_folded_needle = NULL;
     self->empty_score = 1;
+    self->char_mask = 0;
     END_METHOD;
 }
 
@@ -1598,6 +2197,7 @@ _txm_destroy(_self)
     METHOD(TextMatcher, destroy);
 {
     vim_free(self->_needle);
+    vim_free(self->_folded_needle);
     END_DESTROY(TextMatcher);
 }
 
@@ -1611,19 +2211,45 @@ _txm_set_search_str(_self, needle)
 	return;
 
     vim_free(self->_needle);
+    vim_free(self->_folded_needle);
     if (needle && *needle)
     {
 	self->_needle = vim_strsave(needle);
 	self->_need_strlen = STRLEN(needle);
+	self->_folded_needle = vim_strsave(needle);
+	if (self->_folded_needle)
+	    _str_fold(self->_folded_needle, self->_folded_needle);
     }
     else
     {
 	self->_needle = NULL;
 	self->_need_strlen = 0;
+	self->_folded_needle = NULL;
     }
+    self->char_mask = _str_char_mask(self->_needle);
     END_METHOD;
 }
 
+/*
+ * The score of the needle found at p in haystack.
+ */
+    static ulong
+_txm_substring_score(haystack, p)
+    char_u* haystack;
+    char_u* p;
+{
+    ulong score;
+    int d;
+    score = 1;
+    d = p - haystack;
+    if (d < 50)
+       score += 50 - d;
+    /* simplistic start-of-word check */
+    if (d == 0 || isalnum(*(p-1)) != isalnum(*p))
+	score += 30;
+    return score;
+}
+
     static ulong
 _txm_match(_self, haystack)
     void* _self;
@@ -1631,8 +2257,6 @@ _txm_match(_self, haystack)
     METHOD(TextMatcher, match);
 {
     char_u *p, *needle;
-    ulong score;
-    int d;
     if (! haystack || ! *haystack)
 	return 0;
     needle = self->_needle;
@@ -1642,25 +2266,41 @@ _txm_match(_self, haystack)
     p = _stristr(haystack, needle);
     if (! p)
 	return 0;
-    score = 1;
-    d = p - haystack;
-    if (d < 50)
-       score += 50 - d;
-    /* simplistic start-of-word check */
-    if (d == 0 || isalnum(*(p-1)) != isalnum(*p))
-	score += 30;
-    return score;
+    return _txm_substring_score(haystack, p);
     END_METHOD;
 }
 
-    static void
-_txm_init_highlight(_self, haystack)
-    void*	_self;
-    char_u*	haystack;
-    METHOD(TextMatcher, init_highlight);
+    static ulong
+_txm_match_folded(_self, folded, haystack)
+    void* _self;
+    char_u* folded;
+    char_u* haystack;
+    METHOD(TextMatcher, match_folded);
 {
-    END_METHOD;
-}
+    char_u *p;
+
+    /* A subclass that redefines match but not match_folded can't use the
+     * folded text. */
+    if (! folded || ! self->_folded_needle || self->op->match != &_txm_match)
+	return self->op->match(self, haystack);
+    if (! *folded)
+	return 0;
+
+    p = (char_u*) STRSTR(folded, self->_folded_needle);
+    if (! p)
+	return 0;
+    return _txm_substring_score(folded, p);
+    END_METHOD;
+}
+
+    static void
+_txm_init_highlight(_self, haystack)
+    void*	_self;
+    char_u*	haystack;
+    METHOD(TextMatcher, init_highlight);
+{
+    END_METHOD;
+}
 
     static int
 _txm_get_match_at(_self, haystack)
@@ -1678,6 +2318,30 @@ _txm_get_match_at(_self, haystack)
     END_METHOD;
 }
 
+    static int
+_txm_is_monotonic(_self)
+    void*	_self;
+    METHOD(TextMatcher, is_monotonic);
+{
+    /* a string that contains the needle also contains every prefix of it */
+    return 1;
+    END_METHOD;
+}
+
+    static TextMatcher_T*
+_txm_clone(_self)
+    void*	_self;
+    METHOD(TextMatcher, clone);
+{
+    TextMatcher_T* pm = new_TextMatcher();
+    if (! pm)
+	return NULL;
+    pm->empty_score = self->empty_score;
+    pm->op->set_search_str(pm, self->_needle);
+    return pm;
+    END_METHOD;
+}
+
 /* [ooc]
  *
   class TextMatcherRegexp(TextMatcher) [txmrgxp]
@@ -1691,6 +2355,8 @@ _txm_get_match_at(_self, haystack)
     ulong   match(char_u* haystack);
     void    init_highlight(char_u* haystack);
     int     get_match_at(char_u* haystack);
+    int     is_monotonic();
+    TextMatcher* clone();
   };
 */
 
@@ -1724,6 +2390,7 @@ _txmrgxp_set_search_str(_self, needle)
     self->_regmatch.regprog = NULL;
 
     super(TextMatcherRegexp, set_search_str)(self, needle);
+    self->char_mask = 0; /* the characters in a regexp are not literal */
     if (! self->_needle || ! self->_need_strlen)
 	return;
 
@@ -1792,6 +2459,26 @@ _txmrgxp_get_match_at(_self, haystack)
     END_METHOD;
 }
 
+    static int
+_txmrgxp_is_monotonic(_self)
+    void* _self;
+    METHOD(TextMatcherRegexp, is_monotonic);
+{
+    /* eg. 'ab' -> 'ab*' or 'a' -> 'a\|b' match more items */
+    return 0;
+    END_METHOD;
+}
+
+    static TextMatcher_T*
+_txmrgxp_clone(_self)
+    void* _self;
+    METHOD(TextMatcherRegexp, clone);
+{
+    /* vim_regexec() uses global state */
+    return NULL;
+    END_METHOD;
+}
+
 
 /* [ooc]
  *
@@ -1816,6 +2503,7 @@ _txmrgxp_get_match_at(_self, haystack)
   class TextMatcherWords(TextMatcher) [txmwrds]
   {
     char_u*	     _str_words;  // a modified copy of _needle (with NUL characters)
+    char_u*	     _str_words_folded; // the same for _folded_needle
     TmWordMatchExpr* expressions; // list of OR-ed expression
     ListHelper*      lst_expr;
 
@@ -1824,8 +2512,12 @@ _txmrgxp_get_match_at(_self, haystack)
     void    clear_words();
     void    set_search_str(char_u* needle);
     ulong   match(char_u* haystack);
+    ulong   match_folded(char_u* folded, char_u* haystack);
+    ulong   _match_words(char_u* haystack, int folded);
     void    init_highlight(char_u* haystack);
     int     get_match_at(char_u* haystack);
+    int     is_monotonic();
+    TextMatcher* clone();
   };
 */
 
@@ -1889,6 +2581,7 @@ _txmwrds_init(_self)
 {
     self->mode_char = 'W'; /* words */
     self->_str_words = NULL;
+    self->_str_words_folded = NULL;
     self->expressions = NULL;
     self->lst_expr = new_ListHelper();
     self->lst_expr->fn_destroy = &_tmwmxpr_destroy;
@@ -1915,6 +2608,8 @@ _txmwrds_clear_words(_self)
     self->lst_expr->op->delete_all(self->lst_expr, NULL /* no condition => all */);
     vim_free(self->_str_words);
     self->_str_words = NULL;
+    vim_free(self->_str_words_folded);
+    self->_str_words_folded = NULL;
     END_METHOD;
 }
 
@@ -1926,10 +2621,12 @@ _txmwrds_set_search_str(_self, needle)
 {
     int i, wordstart, notword;
     char_u* p;
+    long_u mask;
     TmWordMatchExpr_T* pexpr;
 
     self->op->clear_words(self);
     super(TextMatcherWords, set_search_str)(self, needle);
+    self->char_mask = 0;
     if (! self->_needle || ! self->_need_strlen)
 	return;
 
@@ -1973,6 +2670,31 @@ _txmwrds_set_search_str(_self, needle)
 		_tmwmxpr_add_word_start(pexpr, p, !notword);
 	}
     }
+
+    /* The folded needle has the same length; split it at the same places. */
+    if (self->_folded_needle)
+    {
+	self->_str_words_folded = vim_strsave(self->_folded_needle);
+	if (self->_str_words_folded)
+	{
+	    for (i = 0; i < self->_need_strlen; ++i)
+		if (self->_str_words[i] == NUL)
+		    self->_str_words_folded[i] = NUL;
+	}
+    }
+
+    /* A haystack matches if it matches any expression, so only the characters
+     * that are in the yes-words of every expression are required. */
+    pexpr = self->expressions;
+    if (pexpr)
+	self->char_mask = ~(long_u)0;
+    for (; pexpr; pexpr = pexpr->next)
+    {
+	mask = 0;
+	for (i = 0; i < pexpr->yes_count; i++)
+	    mask |= _str_char_mask(pexpr->yes_words[i]);
+	self->char_mask &= mask;
+    }
     END_METHOD;
 }
 
@@ -1981,6 +2703,34 @@ _txmwrds_match(_self, haystack)
     void* _self;
     char_u* haystack;
     METHOD(TextMatcherWords, match);
+{
+    return self->op->_match_words(self, haystack, FALSE);
+    END_METHOD;
+}
+
+    static ulong
+_txmwrds_match_folded(_self, folded, haystack)
+    void* _self;
+    char_u* folded;
+    char_u* haystack;
+    METHOD(TextMatcherWords, match_folded);
+{
+    if (! folded || ! self->_str_words_folded)
+	return self->op->_match_words(self, haystack, FALSE);
+    return self->op->_match_words(self, folded, TRUE);
+    END_METHOD;
+}
+
+/*
+ * Match the words in haystack. If folded is TRUE, haystack is case-folded and
+ * the folded words are searched with a case-sensitive search.
+ */
+    static ulong
+_txmwrds__match_words(_self, haystack, folded)
+    void* _self;
+    char_u* haystack;
+    int folded;
+    METHOD(TextMatcherWords, _match_words);
 {
     TmWordMatchExpr_T* pexpr;
     int i, notword, score, total_score, d;
@@ -1995,9 +2745,13 @@ _txmwrds_match(_self, haystack)
 	notword = 0;
 	for (i = 0; i < pexpr->not_count; i++)
 	{
-	    if (! *pexpr->not_words[i]) /* empty word */
+	    p = pexpr->not_words[i];
+	    if (! *p) /* empty word */
 		continue;
-	    p = _stristr(haystack, pexpr->not_words[i]);
+	    if (folded)
+		p = (char_u*) STRSTR(haystack, self->_str_words_folded + (p - self->_str_words));
+	    else
+		p = _stristr(haystack, p);
 	    if (p)
 	    {
 		pexpr = pexpr->next;
@@ -2016,7 +2770,10 @@ _txmwrds_match(_self, haystack)
 	    p = pexpr->yes_words[i];
 	    if (! *p) /* empty word */
 		continue;
-	    p = _stristr(haystack, p);
+	    if (folded)
+		p = (char_u*) STRSTR(haystack, self->_str_words_folded + (p - self->_str_words));
+	    else
+		p = _stristr(haystack, p);
 	    if (! p)
 	    {
 		notword = 1;
@@ -2084,6 +2841,36 @@ _txmwrds_get_match_at(_self, haystack)
     END_METHOD;
 }
 
+    static int
+_txmwrds_is_monotonic(_self)
+    void* _self;
+    METHOD(TextMatcherWords, is_monotonic);
+{
+    /* Extending an OR-ed expression or a not-word can match more items. A
+     * needle without yes-words (eg. " " or "+") matches nothing, but its
+     * extension can match. */
+    if (! self->expressions || ! self->expressions->yes_count)
+	return 0;
+    if (self->expressions->next || self->expressions->not_count > 0)
+	return 0;
+    return 1;
+    END_METHOD;
+}
+
+    static TextMatcher_T*
+_txmwrds_clone(_self)
+    void* _self;
+    METHOD(TextMatcherWords, clone);
+{
+    TextMatcherWords_T* pm = new_TextMatcherWords();
+    if (! pm)
+	return NULL;
+    pm->empty_score = self->empty_score;
+    pm->op->set_search_str(pm, self->_needle);
+    return (TextMatcher_T*) pm;
+    END_METHOD;
+}
+
 /* [ooc]
  *
   // A text matcher similar to Command-T
@@ -2115,6 +2902,7 @@ _txmwrds_get_match_at(_self, haystack)
     ulong   _calc_pos_score(char_u* haystack, char_u** positions, int npos);
     void    init_highlight(char_u* haystack);
     int     get_match_at(char_u* haystack);
+    TextMatcher* clone();
   };
  */
 
@@ -2401,6 +3189,341 @@ _txmcmdt_get_match_at(_self, haystack)
     END_METHOD;
 }
 
+    static TextMatcher_T*
+_txmcmdt_clone(_self)
+    void*	_self;
+    METHOD(TextMatcherCmdT, clone);
+{
+    /* the clone gets its own _hays_positions */
+    TextMatcherCmdT_T* pm = new_TextMatcherCmdT();
+    if (! pm)
+	return NULL;
+    pm->empty_score = self->empty_score;
+    pm->last_retry_offset = self->last_retry_offset;
+    pm->op->set_search_str(pm, self->_needle);
+    return (TextMatcher_T*) pm;
+    END_METHOD;
+}
+
+/* [ooc]
+ *
+  // A text matcher that computes the same score as TextMatcherCmdT with
+  // dynamic programming instead of trying every combination of positions.
+  // The score of a matched character depends only on its position and on the
+  // position of the previous matched character, so the best score of a match
+  // that ends in a position can be computed from the best scores on the
+  // previous row. last_retry_offset is ignored; all the positions are used.
+  // The table is allocated in set_search_str because match() runs in the
+  // FilterWorker threads; a haystack with a longer range than
+  // TXMCMDP_MAX_RANGE is scored by TextMatcherCmdT::match.
+  const TXMCMDP_MAX_RANGE = 256;
+
+  class TextMatcherCmdTDp(TextMatcherCmdT) [txmcmdp]
+  {
+    // The cells of the table; one row for every character in the needle,
+    // one cell for every position of the character in haystack.
+    int	    _cell_count;  // number of allocated cells
+    int*    _cell_offs;	  // offset of the character in haystack
+    ulong*  _cell_score;  // best score of a match ending in this cell, 0 - no match
+    int*    _cell_prev;	  // the cell on the previous row used in the best score
+    int*    _cell_maxi;	  // the best cell in the row up to this cell, -1 - none
+    int	    _row_count;	  // number of allocated rows
+    int*    _rows;	  // index of the first cell in every row
+
+    void    init();
+    void    destroy();
+    void    set_search_str(char_u* needle);
+    ulong   match(char_u* haystack);
+    ulong   _match_dp(char_u* haystack, int trace);
+    int     _prepare_cells(int cells);
+    void    init_highlight(char_u* haystack);
+    TextMatcher* clone();
+  };
+ */
+
+    static void
+_txmcmdp_init(_self)
+    void* _self;
+    METHOD(TextMatcherCmdTDp, init);
+{
+    self->mode_char = 'D'; /* command-t, dynamic programming */
+    self->_cell_count = 0;
+    self->_cell_offs = NULL;
+    self->_cell_score = NULL;
+    self->_cell_prev = NULL;
+    self->_cell_maxi = NULL;
+    self->_row_count = 0;
+    self->_rows = NULL;
+    END_METHOD;
+}
+
+    static void
+_txmcmdp_destroy(_self)
+    void* _self;
+    METHOD(TextMatcherCmdTDp, destroy);
+{
+    vim_free(self->_cell_offs);
+    vim_free(self->_cell_score);
+    vim_free(self->_cell_prev);
+    vim_free(self->_cell_maxi);
+    vim_free(self->_rows);
+    END_DESTROY(TextMatcherCmdTDp);
+}
+
+    static void
+_txmcmdp_set_search_str(_self, needle)
+    void*    _self;
+    char_u*  needle;
+    METHOD(TextMatcherCmdTDp, set_search_str);
+{
+    super(TextMatcherCmdTDp, set_search_str)(self, needle);
+    if (self->_need_len > 0)
+	self->op->_prepare_cells(self, TXMCMDP_MAX_RANGE * self->_need_len);
+    END_METHOD;
+}
+
+/*
+ * Make room for the table. The buffers only grow. Called only from the main
+ * thread, Vim's alloc() is not thread-safe.
+ * @returns FALSE if the memory could not be allocated.
+ */
+    static int
+_txmcmdp__prepare_cells(_self, cells)
+    void* _self;
+    int	  cells;
+    METHOD(TextMatcherCmdTDp, _prepare_cells);
+{
+    if (self->_row_count < self->_need_len + 1)
+    {
+	vim_free(self->_rows);
+	self->_rows = (int*) alloc(sizeof(int) * (self->_need_len + 1));
+	self->_row_count = self->_rows ? self->_need_len + 1 : 0;
+	if (! self->_rows)
+	    return FALSE;
+    }
+
+    if (cells <= self->_cell_count)
+	return TRUE;
+
+    vim_free(self->_cell_offs);
+    vim_free(self->_cell_score);
+    vim_free(self->_cell_prev);
+    vim_free(self->_cell_maxi);
+    self->_cell_offs = (int*) alloc(sizeof(int) * cells);
+    self->_cell_score = (ulong*) alloc(sizeof(ulong) * cells);
+    self->_cell_prev = (int*) alloc(sizeof(int) * cells);
+    self->_cell_maxi = (int*) alloc(sizeof(int) * cells);
+    if (! self->_cell_offs || ! self->_cell_score || ! self->_cell_prev || ! self->_cell_maxi)
+    {
+	vim_free(self->_cell_offs);
+	vim_free(self->_cell_score);
+	vim_free(self->_cell_prev);
+	vim_free(self->_cell_maxi);
+	self->_cell_offs = NULL;
+	self->_cell_score = NULL;
+	self->_cell_prev = NULL;
+	self->_cell_maxi = NULL;
+	self->_cell_count = 0;
+	return FALSE;
+    }
+    self->_cell_count = cells;
+    return TRUE;
+    END_METHOD;
+}
+
+/*
+ * The scores are the same as in _txmcmdt__calc_pos_score. A character at
+ * offset d after the previous matched character gets 1000 if d < 2, a bonus
+ * for the special character that precedes it, or 1000/d + 1. Only the last
+ * term depends on the previous cell. It is found by scanning the previous
+ * row backwards until the best score up to a cell can not win any more; the
+ * term is 1 for d > 1000, so the scan is short.
+ */
+    static ulong
+_txmcmdp__match_dp(_self, haystack, trace)
+    void*   _self;
+    char_u* haystack;
+    int	    trace;     // fill _hays_best_positions
+    METHOD(TextMatcherCmdTDp, _match_dp);
+{
+    char_u	*first_pos, *last_pos, *p, *psp;
+    int		need_len, range, ncell, row, cell, prow, pend, j, i, o, d, best_cell;
+    ulong	score, best_score, bonus;
+    int*	offs;
+    ulong*	cscore;
+    int*	cprev;
+    int*	cmaxi;
+    /* the same as in _txmcmdt__calc_pos_score */
+    static char_u special[] = "/.-_ 0123456789";
+
+    need_len = self->_need_len;
+
+    /* find the limits of the search; the same as in _txmcmdt_match */
+    first_pos = _find_char(haystack, self->_need_chars[0]);
+    if (! first_pos)
+	return 0;
+
+    last_pos = _rfind_char(first_pos, self->_need_chars[need_len-1]);
+    if (! last_pos || (last_pos - first_pos + self->_need_char_lens[need_len-1]) < self->_need_strlen)
+	return 0; /* too short, a match is not possible */
+
+    /* the table is not resized here, match() may run in a FilterWorker */
+    range = last_pos - first_pos + 1;
+    if (self->_row_count < need_len + 1 || range * need_len > self->_cell_count)
+	return super(TextMatcherCmdTDp, match)(self, haystack);
+
+    offs = self->_cell_offs;
+    cscore = self->_cell_score;
+    cprev = self->_cell_prev;
+    cmaxi = self->_cell_maxi;
+
+    ncell = 0;
+    for (row = 0; row < need_len; row++)
+    {
+	self->_rows[row] = ncell;
+	prow = (row > 0) ? self->_rows[row-1] : 0;
+	pend = ncell;
+	j = prow; /* the first cell on the previous row that is not before o-1 */
+	p = _find_char(first_pos, self->_need_chars[row]);
+	while (p && p <= last_pos)
+	{
+	    o = p - haystack;
+	    best_score = 0;
+	    best_cell = -1;
+	    if (row == 0)
+	    {
+		if (o < 2)
+		    best_score = 1000;
+		else if ((psp = vim_strchr(special, *(p-1))) != NULL)
+		    best_score = 800 - (psp - special) * 10;
+		else
+		    best_score = 1000 / o + 1;
+	    }
+	    else
+	    {
+		while (j < pend && offs[j] < o - 1)
+		    ++j;
+
+		/* the previous character is adjacent */
+		if (j < pend && offs[j] == o - 1 && cscore[j] > 0)
+		{
+		    best_score = cscore[j] + 1000;
+		    best_cell = j;
+		}
+
+		/* the cells in [prow, j) are at least 2 bytes before o */
+		if (j > prow && cmaxi[j-1] >= 0)
+		{
+		    psp = vim_strchr(special, *(p-1));
+		    if (psp)
+		    {
+			i = cmaxi[j-1];
+			score = cscore[i] + 800 - (psp - special) * 10;
+			if (score > best_score)
+			{
+			    best_score = score;
+			    best_cell = i;
+			}
+		    }
+		    else
+		    {
+			for (i = j - 1; i >= prow && cmaxi[i] >= 0; i--)
+			{
+			    d = o - offs[i];
+			    bonus = 1000 / d + 1;
+			    if (cscore[cmaxi[i]] + bonus <= best_score)
+				break;
+			    if (cscore[i] > 0 && cscore[i] + bonus > best_score)
+			    {
+				best_score = cscore[i] + bonus;
+				best_cell = i;
+			    }
+			}
+		    }
+		}
+	    }
+
+	    if (best_score > 0 && o < 200)
+		best_score += 200 - o;
+
+	    offs[ncell] = o;
+	    cscore[ncell] = best_score;
+	    cprev[ncell] = best_cell;
+	    if (ncell > self->_rows[row] && cmaxi[ncell-1] >= 0
+		    && cscore[cmaxi[ncell-1]] >= best_score)
+		cmaxi[ncell] = cmaxi[ncell-1];
+	    else
+		cmaxi[ncell] = best_score > 0 ? ncell : -1;
+	    ++ncell;
+
+	    ADVANCE_CHAR_P(p);
+	    p = _find_char(p, self->_need_chars[row]);
+	}
+	/* no cell in the row ends a partial match */
+	if (ncell == self->_rows[row] || cmaxi[ncell-1] < 0)
+	    return 0;
+    }
+    self->_rows[need_len] = ncell;
+
+    cell = cmaxi[ncell-1];
+    best_score = cscore[cell];
+
+    if (trace)
+    {
+	for (row = need_len - 1; row >= 0 && cell >= 0; row--)
+	{
+	    self->_hays_best_positions[row] = haystack + offs[cell];
+	    cell = cprev[cell];
+	}
+    }
+
+    return best_score;
+    END_METHOD;
+}
+
+    static ulong
+_txmcmdp_match(_self, haystack)
+    void* _self;
+    char_u* haystack;
+    METHOD(TextMatcherCmdTDp, match);
+{
+    if (! haystack || ! *haystack)
+	return 0;
+    if (! self->_needle || ! *self->_needle)
+	return self->empty_score;
+
+    return self->op->_match_dp(self, haystack, FALSE);
+    END_METHOD;
+}
+
+    static void
+_txmcmdp_init_highlight(_self, haystack)
+    void*	_self;
+    char_u*	haystack;
+    METHOD(TextMatcherCmdTDp, init_highlight);
+{
+    /* find a match to set _hays_best_positions */
+    if (! haystack || ! *haystack || ! self->_needle || ! *self->_needle)
+	return;
+    self->op->_match_dp(self, haystack, TRUE);
+    END_METHOD;
+}
+
+    static TextMatcher_T*
+_txmcmdp_clone(_self)
+    void*	_self;
+    METHOD(TextMatcherCmdTDp, clone);
+{
+    /* the clone gets its own table */
+    TextMatcherCmdTDp_T* pm = new_TextMatcherCmdTDp();
+    if (! pm)
+	return NULL;
+    pm->empty_score = self->empty_score;
+    pm->op->set_search_str(pm, self->_needle);
+    return (TextMatcher_T*) pm;
+    END_METHOD;
+}
+
 /* [ooc]
  *
   typedef void* (*NewObject_Fn)(void);
@@ -2489,6 +3612,10 @@ _txmfac_init(_self)
     pme = new_TextMatcherFactoryEntry();
     pme->op->set(pme, VSTR("sparse"), (NewObject_Fn) &new_TextMatcherCmdT);
     self->_lst_entries->op->add_tail(self->_lst_entries, pme);
+
+    pme = new_TextMatcherFactoryEntry();
+    pme->op->set(pme, VSTR("sparse-dp"), (NewObject_Fn) &new_TextMatcherCmdTDp);
+    self->_lst_entries->op->add_tail(self->_lst_entries, pme);
     END_METHOD;
 }
 
@@ -2553,6 +3680,15 @@ _txmfac_next_matcher(_self, name)
 /* [ooc]
  *
   const MAX_FILTER_SIZE = 127;
+  // lists with less items are always filtered in the main thread
+  const IFLT_MIN_THREADED_ITEMS = 20000;
+  const IFLT_MAX_THREADS = 16;
+  // the number of best items that are sorted after filtering
+  const IFLT_TOP_K = 500;
+  // the number of items that are read from the provider at once
+  const IFLT_BATCH_SIZE = 256;
+  // the number of items scored between the progress checks in sliced mode
+  const IFLT_SLICE_SIZE = 65536;
   class ISearch(object) [isrch]
   {
     char_u  text[MAX_FILTER_SIZE + 1];
@@ -2633,11 +3769,48 @@ _isrch_match(_self, haystack)
 
 /* [ooc]
  *
+  // A copy of the filtered items for a filter text. When the text is shortened
+  // (backspace) the result is restored instead of filtering all the items.
+  struct FilterResult [fltres]
+  {
+    FilterResult* next;    // the result for a shorter text
+    char_u*  text;
+    int	     revision;     // the revision of the model items
+    int	     monotonic;    // the items can be narrowed for an extended text
+    int	     count;
+    int	     sorted;       // the number of items at the start that are sorted
+    int*     items;        // indices of items in the model
+    ulong*   scores;       // filter_score of each item
+    long     size;         // memory used by the result
+    void    init();
+    void    destroy();
+  };
+
+  // Scores a range of the model items in a separate thread. The ranges of the
+  // full scan start on segment boundaries of the model items.
+  struct FilterWorker [fltwrk, variant FEAT_POPUPLIST_THREADS]
+  {
+    pthread_t	 thread;
+    int		 started;     // TRUE if the thread was created
+    TextMatcher* matcher;     // a clone of the filter's matcher, owned by the worker
+    ItemProvider* model;      // get_filter_data must be safe to call from threads
+    int		 skip_titles;
+    int*	 indices;     // the items to score; NULL => all model items
+    int		 first;       // the range [first, last) of indices or model items
+    int		 last;
+    int*	 found;       // indices of matching items in ascending order
+    int		 found_count;
+    void    init();
+    void    destroy();
+    void    run();
+  };
+
   class FltComparator_Score(ItemComparator) [flcmpscr]
   {
     ItemProvider* model;
     void  init();
     int   compare(void* pia, void* pib);
+    int   get_key(void* pi, unsigned int* key);
   };
 
   class FltComparator_TitleScore(ItemComparator) [flcmpttsc]
@@ -2645,6 +3818,7 @@ _isrch_match(_self, haystack)
     ItemProvider* model;
     void  init();
     int   compare(void* pia, void* pib);
+    int   get_key(void* pi, unsigned int* key);
   };
 
   // Filter items into an index field. A TextMatcher gives each item a score.
@@ -2653,7 +3827,7 @@ _isrch_match(_self, haystack)
   // ordered by the highest score of their children. The children below each title
   // are sorted by score.
   //
-  class ItemFilter(object) [iflt]
+  class ItemFilter(object) [iflt, final]
   {
     ItemProvider* model;
     char_u  text[MAX_FILTER_SIZE + 1];
@@ -2668,11 +3842,68 @@ _isrch_match(_self, haystack)
     // TODO: Put keep_titles also in options.
     int	    keep_titles;
 
+    // The text and the model revision that produced the current items. When
+    // the text is extended and the matcher is monotonic for both texts, only
+    // the current items are rescored (incremental narrowing).
+    char_u  _narrow_text[MAX_FILTER_SIZE + 1];
+    int	    _narrow_revision;
+    int	    _narrow_monotonic;
+
+    // The model items [0, _scored_count) were scored when the model had
+    // _scored_base as base_revision; the items appended later are scored
+    // by filter_appended.
+    int	    _scored_count;
+    int	    _scored_base;
+
+    // The results for the prefixes of text, the longest first.
+    // @var history_limit is the memory that the results may use; 0 disables the history.
+    FilterResult* _history;
+    long    _history_size;
+    long    history_limit;
+
+    // @var threads is the number of threads that score the items of large
+    // lists; 0 - one per CPU, 1 - score the items in the main thread.
+    int	    threads;
+
+    // @var top_k is the number of the best items that are sorted after
+    // filtering; the other items are sorted when they are accessed for the
+    // first time. 0 - sort all the items.
+    int	    top_k;
+    int	    _sorted;  // the number of items at the start that are sorted
+
+    // The position of each model item in items, -1 if it was filtered out.
+    // Built on the first get_index_of after filter_items.
+    int*    _positions;
+    int	    _positions_len;
+    int	    _positions_valid;
+
+    // @var slice_size is the number of items that are scored between the
+    // calls to progress; 0 - the items are scored without interruption.
+    // progress is called with the filter as data; when it returns nonzero the
+    // pass is abandoned, the items are incomplete and interrupted is set.
+    int	    slice_size;
+    NotificationCallback progress;
+    int	    interrupted;
+    int	    partial;	// in progress: the items hold the matches found so far
+    int	    scan_done;	// in progress: the number of items that were scored
+    int	    scan_total;
+
     void    init();
     void    destroy();
     void    set_matcher(TextMatcher* pmatcher);
     void    set_text(char_u* ptext);
+    void    clear_history();
+    void    _push_result();
+    int	    _pop_result();
+    int	    _score_parallel(int narrow, int first, int last);
+    void    _score_range(int first, int last);
+    int	    _check_progress(int done, int total, int partial);
+    void    _sort_scored();
+    void    _sort_rest();
+    int	    _build_positions();
     void    filter_items();
+    void    filter_appended();  // add the matching items that were appended to the model
+    void    sort_partial();
     int	    get_item_count();
     int	    is_active();
 
@@ -2685,20 +3916,137 @@ _isrch_match(_self, haystack)
 */
 
     static void
-_flcmpscr_init(_self)
+_fltres_init(_self)
     void* _self;
-    METHOD(FltComparator_Score, init);
+    METHOD(FilterResult, init);
+{
+    self->next = NULL;
+    self->text = NULL;
+    self->revision = 0;
+    self->monotonic = 0;
+    self->count = 0;
+    self->sorted = 0;
+    self->items = NULL;
+    self->scores = NULL;
+    self->size = 0;
+    END_METHOD;
+}
+
+    static void
+_fltres_destroy(_self)
+    void* _self;
+    METHOD(FilterResult, destroy);
+{
+    vim_free(self->text);
+    vim_free(self->items);
+    vim_free(self->scores);
+    END_METHOD;
+}
+
+#ifdef FEAT_POPUPLIST_THREADS
+    static void
+_fltwrk_init(_self)
+    void* _self;
+    METHOD(FilterWorker, init);
 {
+    self->started = 0;
+    self->matcher = NULL;
     self->model = NULL;
+    self->skip_titles = 0;
+    self->indices = NULL;
+    self->first = 0;
+    self->last = 0;
+    self->found = NULL;
+    self->found_count = 0;
     END_METHOD;
 }
 
-    static int
-_flcmpscr_compare(_self, pia, pib)
+    static void
+_fltwrk_destroy(_self)
     void* _self;
-    void* pia;
-    void* pib;
-    METHOD(FltComparator_Score, compare);
+    METHOD(FilterWorker, destroy);
+{
+    CLASS_DELETE(self->matcher);
+    vim_free(self->found);
+    self->found = NULL;
+    END_METHOD;
+}
+
+/*
+ * Score the items in the range and collect the matching ones. Runs in a
+ * worker thread so it may not call Vim functions that use global state.
+ */
+    static void
+_fltwrk_run(_self)
+    void* _self;
+    METHOD(FilterWorker, run);
+{
+    ItemProvider_T* pmodel = self->model;
+    TextMatcher_T* matcher = self->matcher;
+    FilterData_T batch[IFLT_BATCH_SIZE];
+    FilterData_T* pd;
+    ulong score;
+    long_u need_mask = matcher->char_mask;
+    int i, j, n, idx;
+
+    self->found_count = 0;
+    for (i = self->first; i < self->last; )
+    {
+	if (self->indices)
+	{
+	    idx = self->indices[i++];
+	    n = pmodel->op->get_filter_data(pmodel, idx, 1, batch);
+	}
+	else
+	{
+	    idx = i;
+	    n = self->last - i;
+	    if (n > IFLT_BATCH_SIZE)
+		n = IFLT_BATCH_SIZE;
+	    i += n;
+	    n = pmodel->op->get_filter_data(pmodel, idx, n, batch);
+	}
+	for (j = 0, pd = batch; j < n; j++, idx++, pd++)
+	{
+	    if (self->skip_titles && (pd->flags & ITEM_TITLE))
+		score = 0;
+	    else if ((pd->char_mask & need_mask) != need_mask)
+		score = 0;
+	    else
+		score = matcher->op->match_folded(matcher, pd->folded, pd->text);
+	    pd->item->filter_score = score;
+	    if (score > 0)
+		self->found[self->found_count++] = idx;
+	}
+    }
+    END_METHOD;
+}
+
+    static void*
+_fltwrk_thread_main(arg)
+    void* arg;
+{
+    _fltwrk_run(arg);
+    return NULL;
+}
+#endif
+
+    static void
+_flcmpscr_init(_self)
+    void* _self;
+    METHOD(FltComparator_Score, init);
+{
+    self->model = NULL;
+    self->key_words = 3; /* score (2 words), item index */
+    END_METHOD;
+}
+
+    static int
+_flcmpscr_compare(_self, pia, pib)
+    void* _self;
+    void* pia;
+    void* pib;
+    METHOD(FltComparator_Score, compare);
 {
     /* pia and pib are pointers to indices of items in the model */
     PopupItem_T *pa, *pb;
@@ -2725,12 +4073,48 @@ _flcmpscr_compare(_self, pia, pib)
     END_METHOD;
 }
 
+/* The high and the low 32 bits of a score for the radix sort keys. */
+#define SCORE_KEY_HI(score) ((unsigned int)((((long_u)(score)) >> 16) >> 16))
+#define SCORE_KEY_LO(score) ((unsigned int)((long_u)(score) & 0xffffffffUL))
+
+    static int
+_flcmpscr_get_key(_self, pi, key)
+    void* _self;
+    void* pi;
+    unsigned int* key;
+    METHOD(FltComparator_Score, get_key);
+{
+    /* The key gives the same order as compare(): missing items are last. */
+    PopupItem_T *pit;
+    if (!self->model)
+	return FAIL;
+    pit = self->model->op->get_item(self->model, *(int*)pi);
+    if (!pit)
+    {
+	key[0] = key[1] = 0xffffffffU;
+    }
+    else
+    {
+	key[0] = SCORE_KEY_HI(pit->filter_score);
+	key[1] = SCORE_KEY_LO(pit->filter_score);
+	if (self->reverse)
+	{
+	    key[0] = ~key[0];
+	    key[1] = ~key[1];
+	}
+    }
+    key[2] = (unsigned int) *(int*)pi;
+    return OK;
+    END_METHOD;
+}
+
     static void
 _flcmpttsc_init(_self)
     void* _self;
     METHOD(FltComparator_TitleScore, init);
 {
     self->model = NULL;
+    self->key_words = 4; /* parent score, score (2 words), item index */
     END_METHOD;
 }
 
@@ -2772,6 +4156,36 @@ _flcmpttsc_compare(_self, pia, pib)
     END_METHOD;
 }
 
+    static int
+_flcmpttsc_get_key(_self, pi, key)
+    void* _self;
+    void* pi;
+    unsigned int* key;
+    METHOD(FltComparator_TitleScore, get_key);
+{
+    /* The key gives the same order as compare(): missing items are last,
+     * children are sorted from high to low score. */
+    PopupItem_T *pit;
+    if (!self->model)
+	return FAIL;
+    pit = self->model->op->get_item(self->model, *(int*)pi);
+    if (!pit)
+    {
+	key[0] = key[1] = key[2] = 0xffffffffU;
+    }
+    else
+    {
+	key[0] = pit->filter_parent_score;
+	if (self->reverse)
+	    key[0] = 0xffffU - key[0];
+	key[1] = ~SCORE_KEY_HI(pit->filter_score);
+	key[2] = ~SCORE_KEY_LO(pit->filter_score);
+    }
+    key[3] = (unsigned int) *(int*)pi;
+    return OK;
+    END_METHOD;
+}
+
     static void
 _iflt_init(_self)
     void* _self;
@@ -2782,6 +4196,26 @@ _iflt_init(_self)
     self->items = new_SegmentedGrowArrayP(sizeof(int), NULL);
     self->matcher = (TextMatcher_T*) new_TextMatcherWords();
     self->keep_titles = 1;
+    self->_narrow_text[0] = NUL;
+    self->_narrow_revision = 0;
+    self->_narrow_monotonic = 0;
+    self->_scored_count = 0;
+    self->_scored_base = 0;
+    self->_history = NULL;
+    self->_history_size = 0;
+    self->history_limit = 4096L * 1024;
+    self->threads = 0;
+    self->top_k = IFLT_TOP_K;
+    self->_sorted = 0;
+    self->_positions = NULL;
+    self->_positions_len = 0;
+    self->_positions_valid = 0;
+    self->slice_size = 0;
+    init_NotificationCallback(&self->progress);
+    self->interrupted = 0;
+    self->partial = 0;
+    self->scan_done = 0;
+    self->scan_total = 0;
     END_METHOD;
 }
 
@@ -2791,8 +4225,10 @@ _iflt_destroy(_self)
     METHOD(ItemFilter, destroy);
 {
     self->model = NULL; /* filter doesn't own the model */
+    self->op->clear_history(self);
     CLASS_DELETE(self->items);
     CLASS_DELETE(self->matcher);
+    vim_free(self->_positions);
     END_DESTROY(ItemFilter);
 }
 
@@ -2808,6 +4244,8 @@ _iflt_set_matcher(_self, pmatcher)
     self->matcher = pmatcher;
     if (self->matcher)
 	self->matcher->op->set_search_str(self->matcher, self->text);
+    self->_narrow_text[0] = NUL; /* the items were scored by a different matcher */
+    self->op->clear_history(self);
     END_METHOD;
 }
 
@@ -2838,6 +4276,297 @@ _iflt_is_active(_self)
     END_METHOD;
 }
 
+    static void
+_iflt_clear_history(_self)
+    void* _self;
+    METHOD(ItemFilter, clear_history);
+{
+    FilterResult_T* pres;
+    while (self->_history)
+    {
+	pres = self->_history;
+	self->_history = pres->next;
+	_fltres_destroy(pres);
+	vim_free(pres);
+    }
+    self->_history_size = 0;
+    END_METHOD;
+}
+
+/*
+ * Save the current items and their scores on top of the history. The oldest
+ * results are dropped when the history would use more than history_limit.
+ */
+    static void
+_iflt__push_result(_self)
+    void* _self;
+    METHOD(ItemFilter, _push_result);
+{
+    FilterResult_T *pres, *pprev;
+    PopupItem_T* pit;
+    ItemProvider_T* pmodel = self->model;
+    long size, used;
+    int i;
+
+    size = (long)self->items->len * (sizeof(int) + sizeof(ulong)) + STRLEN(self->_narrow_text) + 1;
+    if (size > self->history_limit)
+	return;
+
+    pres = new_FilterResult();
+    if (! pres)
+	return;
+    pres->text = vim_strsave(self->_narrow_text);
+    pres->revision = self->_narrow_revision;
+    pres->monotonic = self->_narrow_monotonic;
+    pres->count = self->items->len;
+    pres->sorted = self->_sorted;
+    pres->size = size;
+    if (pres->count > 0)
+    {
+	pres->items = (int*) alloc(pres->count * sizeof(int));
+	pres->scores = (ulong*) alloc(pres->count * sizeof(ulong));
+    }
+    if (! pres->text || (pres->count > 0 && (! pres->items || ! pres->scores)))
+    {
+	_fltres_destroy(pres);
+	vim_free(pres);
+	return;
+    }
+    for (i = 0; i < pres->count; i++)
+    {
+	pres->items[i] = *(int*) sgarr_get_item(self->items, i);
+	pit = pmodel->op->get_item(pmodel, pres->items[i]);
+	pres->scores[i] = pit ? pit->filter_score : 0;
+    }
+
+    pres->next = self->_history;
+    self->_history = pres;
+    self->_history_size += size;
+
+    /* keep the newest results that fit into the limit */
+    used = 0;
+    pprev = NULL;
+    for (pres = self->_history; pres; pprev = pres, pres = pres->next)
+    {
+	if (used + pres->size > self->history_limit)
+	    break;
+	used += pres->size;
+    }
+    if (pres && pprev)
+    {
+	pprev->next = NULL;
+	while (pres)
+	{
+	    pprev = pres;
+	    pres = pres->next;
+	    _fltres_destroy(pprev);
+	    vim_free(pprev);
+	}
+	self->_history_size = used;
+    }
+    END_METHOD;
+}
+
+/*
+ * Drop the results that don't belong to a prefix of the current text. If a
+ * result for the current text is found, it replaces the current items.
+ * @returns TRUE if the items were restored from the history.
+ */
+    static int
+_iflt__pop_result(_self)
+    void* _self;
+    METHOD(ItemFilter, _pop_result);
+{
+    FilterResult_T *pres;
+    PopupItem_T* pit;
+    ItemProvider_T* pmodel = self->model;
+    int i, *pmi, found;
+
+    found = 0;
+    while (self->_history)
+    {
+	pres = self->_history;
+	if (pres->revision != pmodel->revision)
+	{
+	    self->op->clear_history(self);
+	    break;
+	}
+	if (EQUALS(pres->text, self->text))
+	    found = 1;
+	else if (STARTSWITH(self->text, pres->text))
+	    break;
+
+	self->_history = pres->next;
+	self->_history_size -= pres->size;
+	if (found)
+	{
+	    /* Items that are not in the result must have filter_score 0. */
+	    for (i = 0; i < self->items->len; i++)
+	    {
+		pmi = (int*) sgarr_get_item(self->items, i);
+		pit = pmodel->op->get_item(pmodel, *pmi);
+		if (pit)
+		    pit->filter_score = 0;
+	    }
+	    self->items->op->clear_contents(self->items);
+	    for (i = 0; i < pres->count; i++)
+	    {
+		pmi = (int*) sgarr_get_new_item(self->items);
+		if (pmi)
+		    *pmi = pres->items[i];
+		pit = pmodel->op->get_item(pmodel, pres->items[i]);
+		if (pit)
+		    pit->filter_score = pres->scores[i];
+	    }
+	    self->items->op->truncate(self->items);
+	    self->_sorted = pres->sorted;
+	    STRCPY(self->_narrow_text, pres->text);
+	    self->_narrow_revision = pres->revision;
+	    self->_narrow_monotonic = pres->monotonic;
+	}
+	_fltres_destroy(pres);
+	vim_free(pres);
+	if (found)
+	    break;
+    }
+
+    return found;
+    END_METHOD;
+}
+
+/*
+ * Score the items with one matcher clone per thread. With narrow set the
+ * current items are scored and first and last are ignored, otherwise the model
+ * items in the range [first, last) are scored and appended to the items. The
+ * workers get consecutive ranges and their results are appended in order, so
+ * the items are the same as if they were scored in a single thread.
+ * @returns FALSE if the items have to be scored in the main thread.
+ */
+    static int
+_iflt__score_parallel(_self, narrow, first, last)
+    void* _self;
+    int narrow;
+    int first;
+    int last;
+    METHOD(ItemFilter, _score_parallel);
+{
+#ifdef FEAT_POPUPLIST_THREADS
+    ItemProvider_T* pmodel = self->model;
+    FilterWorker_T* workers;
+    FilterWorker_T* pw;
+    int *indices, *pmi;
+    int nthreads, nworkers, count, chunk, seglen, i, j, ok;
+
+    nthreads = self->threads;
+#ifdef _SC_NPROCESSORS_ONLN
+    if (nthreads < 1)
+	nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (nthreads > IFLT_MAX_THREADS)
+	nthreads = IFLT_MAX_THREADS;
+
+    if (narrow)
+    {
+	first = 0;
+	last = self->items->len;
+    }
+    count = last - first;
+    if (nthreads < 2 || count < IFLT_MIN_THREADED_ITEMS)
+	return 0;
+
+    /* The workers read the items with get_filter_data; only the default
+     * version that reads the items directly is known to be thread-safe. */
+    if (pmodel->op->get_filter_data != &_iprov_get_filter_data
+	    || pmodel->op->get_filter_text != &_iprov_get_filter_text
+	    || pmodel->op->has_flag != &_iprov_has_flag)
+	return 0;
+
+    indices = NULL;
+    seglen = pmodel->items->segment_len;
+    if (narrow)
+    {
+	indices = (int*) alloc(count * sizeof(int));
+	if (! indices)
+	    return 0;
+	for (i = 0; i < count; i++)
+	    indices[i] = *(int*) sgarr_get_item(self->items, i);
+	chunk = (count + nthreads - 1) / nthreads;
+    }
+    else
+    {
+	chunk = (count + nthreads - 1) / nthreads;
+	chunk = (chunk + seglen - 1) / seglen * seglen;
+    }
+
+    workers = (FilterWorker_T*) alloc(nthreads * sizeof(FilterWorker_T));
+    if (! workers)
+    {
+	vim_free(indices);
+	return 0;
+    }
+
+    /* prepare everything in the main thread, Vim's alloc() is not thread-safe */
+    ok = 1;
+    nworkers = 0;
+    for (i = first; i < last; i += chunk)
+    {
+	pw = &workers[nworkers++];
+	init_FilterWorker(pw);
+	pw->model = pmodel;
+	pw->skip_titles = pmodel->has_title_items && !self->keep_titles;
+	pw->indices = indices;
+	pw->first = i;
+	pw->last = (i + chunk < last) ? i + chunk : last;
+	pw->matcher = self->matcher->op->clone(self->matcher);
+	pw->found = (int*) alloc((pw->last - pw->first) * sizeof(int));
+	if (! pw->matcher || ! pw->found)
+	    ok = 0;
+    }
+
+    if (ok)
+    {
+	for (i = 1; i < nworkers; i++)
+	{
+	    pw = &workers[i];
+	    pw->started = (pthread_create(&pw->thread, NULL, &_fltwrk_thread_main, pw) == 0);
+	}
+	_fltwrk_run(&workers[0]); /* the main thread is also a worker */
+	for (i = 1; i < nworkers; i++)
+	{
+	    pw = &workers[i];
+	    if (pw->started)
+		pthread_join(pw->thread, NULL);
+	    else
+		_fltwrk_run(pw);
+	}
+
+	/* merge in the order of the ranges */
+	if (narrow)
+	    self->items->op->clear_contents(self->items);
+	for (i = 0; i < nworkers; i++)
+	{
+	    pw = &workers[i];
+	    for (j = 0; j < pw->found_count; j++)
+	    {
+		pmi = (int*) sgarr_get_new_item(self->items);
+		if (pmi)
+		    *pmi = pw->found[j];
+	    }
+	}
+	self->items->op->truncate(self->items);
+    }
+
+    for (i = 0; i < nworkers; i++)
+	_fltwrk_destroy(&workers[i]);
+    vim_free(workers);
+    vim_free(indices);
+    return ok;
+#else
+    return 0;
+#endif
+    END_METHOD;
+}
+
     static void
 _iflt_filter_items(_self)
     void* _self;
@@ -2848,46 +4577,143 @@ _iflt_filter_items(_self)
     TextMatcher_T* matcher;
     FltComparator_Score_T* pcmp;
     SegmentedGrowArray_T* title_items;
-    int item_count, i, handle_titles;
-    int *pmi;
+    FilterData_T batch[IFLT_BATCH_SIZE];
+    FilterData_T* pd;
+    int item_count, i, handle_titles, skip_titles, narrow, monotonic, nkept;
+    int sliced, abandoned, first, last;
+    int *pmi, *pmikept;
     ulong score;
+    long_u need_mask;
 
-    self->items->op->clear(self->items);
-    if (STRLEN(self->text) < 1 || !self->matcher)
+    pmodel = self->model;
+    matcher = self->matcher;
+    self->_positions_valid = 0;
+    self->interrupted = 0;
+
+    /* The previous items can be narrowed if the text was extended. The items
+     * that are not in the previous result have filter_score 0 and a monotonic
+     * matcher can't match them with the extended text. */
+    if (self->op->_pop_result(self))
 	return;
 
+    narrow = *self->_narrow_text != NUL
+	&& self->_narrow_revision == pmodel->revision
+	&& STARTSWITH(self->text, self->_narrow_text);
+
+    /* remember the result for the shorter text */
+    if (narrow && ! EQUALS(self->text, self->_narrow_text))
+	self->op->_push_result(self);
+    /* A needle that matches nothing (eg. " " for words) can't be narrowed
+     * although its extension is monotonic. */
+    monotonic = matcher && matcher->op->is_monotonic(matcher);
+    narrow = narrow && monotonic && self->_narrow_monotonic;
+
+    STRCPY(self->_narrow_text, self->text);
+    self->_narrow_revision = pmodel->revision;
+    self->_narrow_monotonic = monotonic;
+
+    self->_sorted = 0;
+    if (! narrow)
+	self->items->op->clear(self->items);
+    if (STRLEN(self->text) < 1 || !matcher)
+    {
+	self->items->op->clear(self->items);
+	*self->_narrow_text = NUL;
+	return;
+    }
+
     pcmp = NULL;
-    pmodel = self->model;
-    matcher = self->matcher;
     handle_titles = pmodel->has_title_items;
     item_count = pmodel->op->get_item_count(pmodel);
-    for(i = 0; i < item_count; i++)
+    if (! narrow)
+	self->items->op->size_hint(self->items, item_count);
+
+    /* The items that don't have all the characters of the needle are rejected
+     * without calling the matcher. The masks are made from the item text. */
+    need_mask = matcher->char_mask;
+    skip_titles = handle_titles && !self->keep_titles;
+
+    /* In sliced mode the progress observer is asked between the slices if
+     * the pass should continue. */
+    sliced = self->slice_size > 0 && self->progress.callback != NULL;
+    abandoned = 0;
+
+    if (narrow && (!sliced || self->items->len <= self->slice_size)
+	    && self->op->_score_parallel(self, 1, 0, 0))
     {
-	if (handle_titles && !self->keep_titles && pmodel->op->has_flag(pmodel, i, ITEM_TITLE))
-	    score = 0;
-	else
-	    score = matcher->op->match(matcher, pmodel->op->get_filter_text(pmodel, i));
-	pit = pmodel->op->get_item(pmodel, i); /* TODO: set-item-score() */
-	if (pit)
-	    pit->filter_score = score;
-	if (score <= 0)
-	    continue;
+	/* pass */
+    }
+    else if (narrow)
+    {
+	/* rescore the previous items and compact the index in place */
+	nkept = 0;
+	for(i = 0; i < self->items->len; i++)
+	{
+	    if (sliced && i > 0 && i % self->slice_size == 0
+		    && self->op->_check_progress(self, i, self->items->len, 0))
+	    {
+		/* keep the items that were not rescored */
+		for (; i < self->items->len; i++, nkept++)
+		{
+		    pmi = (int*) sgarr_get_item(self->items, i);
+		    pmikept = (int*) sgarr_get_item(self->items, nkept);
+		    *pmikept = *pmi;
+		}
+		abandoned = 1;
+		break;
+	    }
+	    pmi = (int*) sgarr_get_item(self->items, i);
+	    if (pmodel->op->get_filter_data(pmodel, *pmi, 1, batch) < 1)
+		continue;
+	    pd = batch;
+	    if (skip_titles && (pd->flags & ITEM_TITLE))
+		score = 0;
+	    else if ((pd->char_mask & need_mask) != need_mask)
+		score = 0;
+	    else
+		score = matcher->op->match_folded(matcher, pd->folded, pd->text);
+	    if (pd->item)
+		pd->item->filter_score = score;
+	    if (score <= 0)
+		continue;
+
+	    pmikept = (int*) sgarr_get_item(self->items, nkept);
+	    *pmikept = *pmi;
+	    ++nkept;
+	}
+	self->items->len = nkept;
+	self->items->op->truncate(self->items);
+    }
+    else
+    {
+	for (first = 0; first < item_count; first = last)
+	{
+	    last = (sliced && item_count - first > self->slice_size)
+		? first + self->slice_size : item_count;
+	    if (first > 0 && self->op->_check_progress(self, first, item_count,
+			!handle_titles || !self->keep_titles))
+	    {
+		abandoned = 1;
+		break;
+	    }
+	    self->op->_score_range(self, first, last);
+	}
+    }
 
-	pmi = (int*) self->items->op->get_new_item(self->items);
-	if (pmi)
-	    *pmi = i;
+    if (abandoned)
+    {
+	/* The items are incomplete and they are sorted when they are accessed.
+	 * The next pass has to score all the items. */
+	*self->_narrow_text = NUL;
+	self->interrupted = 1;
+	return;
     }
+    self->_scored_count = item_count;
+    self->_scored_base = pmodel->base_revision;
 
     if (! handle_titles || ! self->keep_titles)
     {
-	/* TODO: an option to sort by score or to keep the original order */
-	if (!pcmp)
-	    pcmp = new_FltComparator_Score();
-	pcmp->model = self->model;
-	pcmp->reverse = 1;
-	self->items->op->sort(self->items, (ItemComparator_T*)pcmp);
-	CLASS_DELETE(pcmp);
-
+	self->op->_sort_scored(self);
 	return;
     }
 
@@ -2905,7 +4731,7 @@ _iflt_filter_items(_self)
 	    if (pit->filter_score <= 0 && score > 0)
 	    {
 		/* a title item has to be displayed because a child matched */
-		pmi = (int*) self->items->op->get_new_item(self->items);
+		pmi = (int*) sgarr_get_new_item(self->items);
 		if (pmi)
 		    *pmi = i;
 	    }
@@ -2916,10 +4742,12 @@ _iflt_filter_items(_self)
 	    pit->filter_score = score;
 	    if (score > 0)
 	    {
-		pmi = (int*) title_items->op->get_new_item(title_items);
+		pmi = (int*) sgarr_get_new_item(title_items);
 		if (pmi)
 		    *pmi = i;
 	    }
+	    else
+		pit->filter_parent_score = 0; /* may be left over from a previous filter */
 	    score = 0;
 	    continue;
 	}
@@ -2939,7 +4767,7 @@ _iflt_filter_items(_self)
     score = 0xffff; /* ushort_max */
     for (i = 0; i < title_items->len; ++i)
     {
-	pmi = (int*) title_items->op->get_item(title_items, i);
+	pmi = (int*) sgarr_get_item(title_items, i);
 	if (! pmi)
 	    continue;
 	pit = pmodel->op->get_item(pmodel, *pmi);
@@ -2978,7 +4806,245 @@ _iflt_filter_items(_self)
 	ptcmp->reverse = 1;
 	self->items->op->sort(self->items, (ItemComparator_T*)ptcmp);
 	CLASS_DELETE(ptcmp);
+	self->_sorted = self->items->len;
+    }
+    END_METHOD;
+}
+
+/*
+ * Score the model items [first, last) and append the matches to the items.
+ */
+    static void
+_iflt__score_range(_self, first, last)
+    void* _self;
+    int first;
+    int last;
+    METHOD(ItemFilter, _score_range);
+{
+    ItemProvider_T *pmodel;
+    TextMatcher_T* matcher;
+    FilterData_T batch[IFLT_BATCH_SIZE];
+    FilterData_T* pd;
+    int i, j, n, skip_titles;
+    int *pmi;
+    ulong score;
+    long_u need_mask;
+
+    if (self->op->_score_parallel(self, 0, first, last))
+	return;
+
+    pmodel = self->model;
+    matcher = self->matcher;
+    need_mask = matcher->char_mask;
+    skip_titles = pmodel->has_title_items && !self->keep_titles;
+    for(i = first; i < last; i += n)
+    {
+	n = last - i;
+	if (n > IFLT_BATCH_SIZE)
+	    n = IFLT_BATCH_SIZE;
+	n = pmodel->op->get_filter_data(pmodel, i, n, batch);
+	if (n < 1)
+	    break;
+	for (j = 0, pd = batch; j < n; j++, pd++)
+	{
+	    if (skip_titles && (pd->flags & ITEM_TITLE))
+		score = 0;
+	    else if ((pd->char_mask & need_mask) != need_mask)
+		score = 0;
+	    else
+		score = matcher->op->match_folded(matcher, pd->folded, pd->text);
+	    if (pd->item)
+		pd->item->filter_score = score;
+	    if (score <= 0)
+		continue;
+
+	    pmi = (int*) sgarr_get_new_item(self->items);
+	    if (pmi)
+		*pmi = i + j;
+	}
+    }
+    END_METHOD;
+}
+
+/*
+ * Score the items that were appended to the model after the last pass and
+ * add the matches to the items. When the items can't be extended a full pass
+ * is made: the last pass was interrupted, the model items were removed or
+ * reordered, or the titles are kept with their children.
+ */
+    static void
+_iflt_filter_appended(_self)
+    void* _self;
+    METHOD(ItemFilter, filter_appended);
+{
+    ItemProvider_T *pmodel;
+    int item_count;
+
+    pmodel = self->model;
+    if (STRLEN(self->text) < 1 || !self->matcher)
+	return;
+
+    item_count = pmodel->op->get_item_count(pmodel);
+    if (self->interrupted
+	    || ! EQUALS(self->text, self->_narrow_text)
+	    || self->_scored_base != pmodel->base_revision
+	    || self->_scored_count > item_count
+	    || (pmodel->has_title_items && self->keep_titles))
+    {
+	self->op->filter_items(self);
+	return;
+    }
+    if (self->_scored_count == item_count)
+	return;
+
+    /* The results in the history don't have the new items; they are dropped
+     * by _pop_result because the revision changed. */
+    self->op->_score_range(self, self->_scored_count, item_count);
+    self->_scored_count = item_count;
+    self->_narrow_revision = pmodel->revision;
+    self->_positions_valid = 0;
+    self->op->_sort_scored(self);
+    END_METHOD;
+}
+
+/*
+ * Report the progress of a sliced pass to the progress observer. With partial
+ * set the items hold the matches found so far and the observer may display
+ * them after calling sort_partial().
+ * @returns TRUE if the pass has to be abandoned.
+ */
+    static int
+_iflt__check_progress(_self, done, total, partial)
+    void* _self;
+    int done;
+    int total;
+    int partial;
+    METHOD(ItemFilter, _check_progress);
+{
+    int abandon;
+
+    self->scan_done = done;
+    self->scan_total = total;
+    self->partial = partial;
+    abandon = _ntfcb_call(&self->progress, self);
+
+    /* the scan continues to append to the items */
+    self->partial = 0;
+    self->_sorted = 0;
+    self->_positions_valid = 0;
+    return abandon;
+    END_METHOD;
+}
+
+/*
+ * Sort the best of the matches found so far by an unfinished pass so that
+ * they can be displayed. Only valid in progress when partial is set.
+ */
+    static void
+_iflt_sort_partial(_self)
+    void* _self;
+    METHOD(ItemFilter, sort_partial);
+{
+    if (self->partial)
+	self->op->_sort_scored(self);
+    END_METHOD;
+}
+
+/*
+ * Sort the items by score. With top_k only the best items are sorted; the
+ * rest is sorted in _sort_rest when it is needed.
+ */
+    static void
+_iflt__sort_scored(_self)
+    void* _self;
+    METHOD(ItemFilter, _sort_scored);
+{
+    FltComparator_Score_T* pcmp;
+
+    /* TODO: an option to sort by score or to keep the original order */
+    pcmp = new_FltComparator_Score();
+    pcmp->model = self->model;
+    pcmp->reverse = 1;
+    if (self->top_k > 0 && self->items->len > self->top_k)
+    {
+	self->items->op->partial_sort(self->items, self->top_k, (ItemComparator_T*)pcmp);
+	self->_sorted = self->top_k;
+    }
+    else
+    {
+	self->items->op->sort(self->items, (ItemComparator_T*)pcmp);
+	self->_sorted = self->items->len;
+    }
+    CLASS_DELETE(pcmp);
+    END_METHOD;
+}
+
+/*
+ * Sort the items that were left unsorted by the top-k selection in
+ * filter_items.
+ */
+    static void
+_iflt__sort_rest(_self)
+    void* _self;
+    METHOD(ItemFilter, _sort_rest);
+{
+    FltComparator_Score_T* pcmp;
+    int i;
+
+    if (self->_sorted >= self->items->len)
+	return;
+
+    pcmp = new_FltComparator_Score();
+    pcmp->model = self->model;
+    pcmp->reverse = 1;
+    self->items->op->sort_range(self->items, self->_sorted, self->items->len - 1, (ItemComparator_T*)pcmp);
+    CLASS_DELETE(pcmp);
+
+    if (self->_positions_valid)
+    {
+	for (i = self->_sorted; i < self->items->len; i++)
+	    self->_positions[*(int*) sgarr_get_item(self->items, i)] = i;
+    }
+    self->_sorted = self->items->len;
+    END_METHOD;
+}
+
+/*
+ * Map the model indices of the filtered items to their positions.
+ * @returns FAIL if the memory for the map could not be allocated.
+ */
+    static int
+_iflt__build_positions(_self)
+    void* _self;
+    METHOD(ItemFilter, _build_positions);
+{
+    int i, count, *pmi;
+
+    if (self->_positions_valid)
+	return OK;
+
+    count = self->model->op->get_item_count(self->model);
+    if (count > self->_positions_len || ! self->_positions)
+    {
+	vim_free(self->_positions);
+	self->_positions_len = 0;
+	self->_positions = (int*) alloc((count > 0 ? count : 1) * sizeof(int));
+	if (! self->_positions)
+	    return FAIL;
+	self->_positions_len = count;
+    }
+
+    /* all the bytes 0xff == -1 */
+    vim_memset(self->_positions, 0xff, self->_positions_len * sizeof(int));
+    for (i = 0; i < self->items->len; i++)
+    {
+	pmi = (int*) sgarr_get_item(self->items, i);
+	if (*pmi >= 0 && *pmi < self->_positions_len)
+	    self->_positions[*pmi] = i;
     }
+
+    self->_positions_valid = 1;
+    return OK;
     END_METHOD;
 }
 
@@ -3006,7 +5072,10 @@ _iflt_get_model_index(_self, index)
     if (index < 0 || index >= self->items->len)
 	return -1;
 
-    return *(int*) self->items->op->get_item(self->items, index);
+    if (index >= self->_sorted)
+	self->op->_sort_rest(self);
+
+    return *(int*) sgarr_get_item(self->items, index);
     END_METHOD;
 }
 
@@ -3016,7 +5085,7 @@ _iflt_get_index_of(_self, model_index)
     int model_index;
     METHOD(ItemFilter, get_index_of);
 {
-    int i, item_count;
+    int i, item_count, first;
     int *pmi;
     if (STRLEN(self->text) < 1)
 	return model_index;
@@ -3025,12 +5094,40 @@ _iflt_get_index_of(_self, model_index)
     if (model_index < 0 || model_index >= item_count)
 	return -1;
 
+    if (self->op->_build_positions(self) == OK)
+    {
+	if (model_index >= self->_positions_len)
+	    return -1;
+	i = self->_positions[model_index];
+	if (i >= self->_sorted)
+	{
+	    /* the position is known only after the rest is sorted */
+	    self->op->_sort_rest(self);
+	    i = self->_positions[model_index];
+	}
+	return i;
+    }
+
+    /* out of memory; search the items */
     item_count = self->items->len;
     for(i = 0; i < item_count; i++)
     {
-	pmi = (int*) self->items->op->get_item(self->items, i);
+	pmi = (int*) sgarr_get_item(self->items, i);
 	if (pmi && *pmi == model_index)
-	    return i;
+	{
+	    if (i < self->_sorted)
+		return i;
+	    /* the position is known only after the rest is sorted */
+	    first = self->_sorted;
+	    self->op->_sort_rest(self);
+	    for(i = first; i < item_count; i++)
+	    {
+		pmi = (int*) sgarr_get_item(self->items, i);
+		if (pmi && *pmi == model_index)
+		    return i;
+	    }
+	    break;
+	}
     }
 
     return -1;
@@ -3186,14 +5283,16 @@ _bxal_align(_self, box, border)
   const KM_PREFIX    = 1;
   const KM_MATCH     = 2;
   const KM_AMBIGUOUS = (KM_PREFIX | KM_MATCH);
-  // TODO: SimpleKeymap could be implemented as a tree where every level
-  // consumes a byte of the input sequence. Maybe it would be easier to
-  // find ambiguities this way.
-  //    struct _kmap_ {
-  //       char_u  piece;
-  //       char_u* command;
-  //       struct _kmap_ children[];
-  //    }
+  // A node of the compiled keymap trie. The children of a node are stored
+  // consecutively in the node array, sorted by byte.
+  struct KeymapNode [kmnode]
+  {
+    int		first_child; // index of the first child in the node array
+    short	child_count;
+    char_u	byte;	     // the byte that leads from the parent to this node
+    char_u	is_key;	     // the path to this node is a mapped sequence
+    void	init();
+  };
   // TODO: (maybe) special commands
   //    @'seq   - stuff the sequence seq into the input buffer (similar to remap)
   //    @#cmd   - accept an operator and pass it to the command cmd
@@ -3204,6 +5303,11 @@ _bxal_align(_self, box, border)
      dict_T*	key2cmd;    // maps a raw Vim sequence to a command name
      int	has_insert; // kmap is used for text insertion
      char_u	mode_char;  // displayed in the border when input is active; only used with has_insert
+     // The sequences are also compiled into a byte trie so that find_key can
+     // detect matches and prefixes in O(sequence length). The trie is rebuilt
+     // lazily on the first lookup after the keymap changes.
+     KeymapNode* _trie;	    // node 0 is the root; NULL when the trie is not built
+     int	_trie_valid;
 
      void   init();
      void   destroy();
@@ -3222,9 +5326,24 @@ _bxal_align(_self, box, border)
      // void	clear_key_prefix(char_u* sequence);
      void	clear_all_keys();
      // void	get_mapped_keys(); // needed only to implement help
+
+     void	_build_trie();
+     int	_scan_keys(char_u* sequence);
   };
 */
 
+    static void
+_kmnode_init(_self)
+    void* _self;
+    METHOD(KeymapNode, init);
+{
+    self->first_child = 0;
+    self->child_count = 0;
+    self->byte = NUL;
+    self->is_key = FALSE;
+    END_METHOD;
+}
+
     static void
 _skmap_init(_self)
     void* _self;
@@ -3235,6 +5354,8 @@ _skmap_init(_self)
     self->mode_char = NUL;
     self->key2cmd = dict_alloc();
     ++self->key2cmd->dv_refcount;
+    self->_trie = NULL;
+    self->_trie_valid = FALSE;
     END_METHOD;
 }
 
@@ -3249,6 +5370,8 @@ _skmap_destroy(_self)
 	dict_unref(self->key2cmd);
 	self->key2cmd = NULL;
     }
+    vim_free(self->_trie);
+    self->_trie = NULL;
     END_DESTROY(SimpleKeymap);
 }
 
@@ -3314,6 +5437,7 @@ _skmap_set_key(_self, sequence, command)
     if (pi)
 	dictitem_remove(self->key2cmd, pi);
     dict_add_nr_str(self->key2cmd, (char*)sequence, 0, command);
+    self->_trie_valid = FALSE;
     END_METHOD;
 }
 
@@ -3325,38 +5449,199 @@ _skmap_get_command(_self, sequence, copy)
     METHOD(SimpleKeymap, get_command);
 {
     dictitem_T* seqmap;
-    seqmap = dict_find(self->key2cmd, sequence, -1L);
-    if (seqmap)
+    seqmap = dict_find(self->key2cmd, sequence, -1L);
+    if (seqmap)
+    {
+	if (copy)
+	    return vim_strsave(seqmap->di_tv.vval.v_string);
+	else
+	    return seqmap->di_tv.vval.v_string;
+    }
+
+    return NULL;
+    END_METHOD;
+}
+
+    static int
+_skmap_find_key(_self, sequence)
+    void* _self;
+    char_u* sequence;
+    METHOD(SimpleKeymap, find_key);
+{
+    KeymapNode_T* node;
+    KeymapNode_T* child;
+    char_u* p;
+    int lo, hi, mid, match;
+
+    if (!self->_trie_valid)
+	self->op->_build_trie(self);
+    if (!self->_trie)
+	return self->op->_scan_keys(self, sequence);
+
+    /* Follow the sequence down the trie. The children of a node are sorted
+     * by byte so they can be searched with bisection. */
+    node = self->_trie;
+    for (p = sequence; *p != NUL; p++)
+    {
+	child = NULL;
+	lo = node->first_child;
+	hi = lo + node->child_count - 1;
+	while (lo <= hi)
+	{
+	    mid = (lo + hi) / 2;
+	    if (self->_trie[mid].byte < *p)
+		lo = mid + 1;
+	    else if (self->_trie[mid].byte > *p)
+		hi = mid - 1;
+	    else
+	    {
+		child = &self->_trie[mid];
+		break;
+	    }
+	}
+	if (!child)
+	    return KM_NOTFOUND;
+	node = child;
+    }
+
+    match = 0; /* KM_NOTFOUND */
+    if (node->is_key)
+    {
+	match |= KM_MATCH;
+#ifdef DEBUG
+	LOG(("   '%s' --> '%s'", sequence, self->op->get_command(self, sequence, FALSE)));
+#endif
+    }
+    /* A node with children is a strict prefix of a longer sequence */
+    if (node->child_count > 0)
+    {
+#ifdef DEBUG
+	if (match)
+	    LOG(("   '%s' AMBIGUOUS", sequence));
+#endif
+	match |= KM_PREFIX;
+    }
+
+    return match;
+    END_METHOD;
+}
+
+/*
+ * Add the children of the trie node at index inode. All the keys share the
+ * first depth bytes that lead to the node and the keys are sorted. The
+ * children are allocated at the end of the node array, *plen is updated.
+ */
+    static void
+_kmtrie_add_children(nodes, plen, inode, keys, count, depth)
+    KeymapNode_T* nodes;
+    int* plen;
+    int inode;
+    char_u** keys;
+    int count;
+    int depth;
+{
+    int i, j, ichild, nchildren;
+
+    /* A key that ends at this node sorts before the longer keys. */
+    i = 0;
+    while (i < count && keys[i][depth] == NUL)
+    {
+	nodes[inode].is_key = TRUE;
+	++i;
+    }
+
+    nchildren = 0;
+    for (j = i; j < count; j++)
+    {
+	if (j == i || keys[j][depth] != keys[j-1][depth])
+	    ++nchildren;
+    }
+    nodes[inode].first_child = *plen;
+    nodes[inode].child_count = nchildren;
+    *plen += nchildren;
+
+    ichild = nodes[inode].first_child;
+    while (i < count)
+    {
+	j = i + 1;
+	while (j < count && keys[j][depth] == keys[i][depth])
+	    ++j;
+	init_KeymapNode(&nodes[ichild]);
+	nodes[ichild].byte = keys[i][depth];
+	_kmtrie_add_children(nodes, plen, ichild, keys + i, j - i, depth + 1);
+	++ichild;
+	i = j;
+    }
+}
+
+    static int
+_kmtrie_compare_keys(a, b)
+    const void* a;
+    const void* b;
+{
+    return STRCMP(*(char_u**)a, *(char_u**)b);
+}
+
+    static void
+_skmap__build_trie(_self)
+    void* _self;
+    METHOD(SimpleKeymap, _build_trie);
+{
+    DictIterator_T* pitkeys;
+    dictitem_T* seqmap;
+    char_u** keys;
+    int count, nodes_len;
+    long_u nbytes;
+
+    vim_free(self->_trie);
+    self->_trie = NULL;
+    self->_trie_valid = FALSE;
+
+    keys = (char_u**) alloc((unsigned)(sizeof(char_u*) * (self->key2cmd->dv_hashtab.ht_used + 1)));
+    if (!keys)
+	return;
+
+    /* Every byte of every key adds at most one node */
+    nbytes = 1;
+    count = 0;
+    pitkeys = new_DictIterator();
+    for(seqmap = pitkeys->op->begin(pitkeys, self->key2cmd); seqmap != NULL; seqmap = pitkeys->op->next(pitkeys))
     {
-	if (copy)
-	    return vim_strsave(seqmap->di_tv.vval.v_string);
-	else
-	    return seqmap->di_tv.vval.v_string;
+	keys[count++] = seqmap->di_key;
+	nbytes += STRLEN(seqmap->di_key);
     }
+    CLASS_DELETE(pitkeys);
 
-    return NULL;
+    self->_trie = (KeymapNode_T*) alloc((unsigned)(sizeof(KeymapNode_T) * nbytes));
+    if (self->_trie)
+    {
+	qsort((void*)keys, (size_t)count, sizeof(char_u*), _kmtrie_compare_keys);
+	init_KeymapNode(&self->_trie[0]);
+	nodes_len = 1;
+	_kmtrie_add_children(self->_trie, &nodes_len, 0, keys, count, 0);
+	self->_trie_valid = TRUE;
+    }
+    vim_free(keys);
     END_METHOD;
 }
 
+/*
+ * Find the sequence by scanning all the keys. Used when the trie can not be
+ * built.
+ */
     static int
-_skmap_find_key(_self, sequence)
+_skmap__scan_keys(_self, sequence)
     void* _self;
     char_u* sequence;
-    METHOD(SimpleKeymap, find_key);
+    METHOD(SimpleKeymap, _scan_keys);
 {
     dictitem_T* seqmap;
     DictIterator_T* pitkeys;
     int seq_len, match;
 
     match = 0; /* KM_NOTFOUND */
-    seqmap = dict_find(self->key2cmd, sequence, -1L);
-    if (seqmap)
-    {
+    if (dict_find(self->key2cmd, sequence, -1L))
 	match |= KM_MATCH;
-#ifdef DEBUG
-	LOG(("   '%s' --> '%s'", sequence, seqmap->di_tv.vval.v_string));
-#endif
-    }
 
     /* Test if sequence is a prefix of any of the items in the current modemap */
     seq_len = STRLEN(sequence);
@@ -3366,10 +5651,6 @@ _skmap_find_key(_self, sequence)
     {
 	if (EQUALSN(seqmap->di_key, sequence, seq_len) && *(seqmap->di_key + seq_len) != NUL)
 	{
-#ifdef DEBUG
-	    if (match)
-		LOG(("   '%s' --> '%s' AMBIGUOUS", seqmap->di_key, seqmap->di_tv.vval.v_string));
-#endif
 	    match |= KM_PREFIX;
 	    break;
 	}
@@ -3394,6 +5675,7 @@ _skmap_clear_all_keys(_self)
     dict_unref(self->key2cmd);
     self->key2cmd = dict_alloc();
     ++self->key2cmd->dv_refcount;
+    self->_trie_valid = FALSE;
     END_METHOD;
 }
 
@@ -3625,6 +5907,7 @@ _wbor_draw_top(_self)
     METHOD(WindowBorder, draw_top);
 {
     int row, col, right, ch;
+    LineWriter_T linewriter;
     LineWriter_T* writer;
     if (! self->inner_box || !self->active[WINBORDER_TOP])
 	return;
@@ -3636,7 +5919,8 @@ _wbor_draw_top(_self)
 	screen_putchar(self->border_chars[WINBORDER_LEFT*2+1], row, col-1, self->border_attr);
     screen_putchar(self->border_chars[WINBORDER_TOP*2], row, col, self->border_attr);
 
-    writer = new_LineWriter();
+    writer = &linewriter;
+    init_LineWriter(writer);
     writer->min_col = self->inner_box->left + 1;
     writer->max_col = right - 1;
     writer->tab_size = -1;
@@ -3647,7 +5931,7 @@ _wbor_draw_top(_self)
     if (self->active[WINBORDER_RIGHT])
 	screen_putchar(self->border_chars[WINBORDER_TOP*2+1], row, right+1, self->border_attr);
 
-    CLASS_DELETE(writer);
+    writer->op->destroy(writer);
     END_METHOD;
 }
 
@@ -3658,6 +5942,7 @@ _wbor_draw_bottom(_self)
 {
     int row, col, endcol, right, ch, chbot, attr, iw;
     char_u* input;
+    LineWriter_T linewriter;
     LineWriter_T* writer;
 
     if (! self->inner_box || !self->active[WINBORDER_BOTTOM])
@@ -3677,7 +5962,8 @@ _wbor_draw_bottom(_self)
     screen_putchar(chbot, row, col, attr);
     ++col;
 
-    writer = new_LineWriter();
+    writer = &linewriter;
+    init_LineWriter(writer);
     writer->tab_size = -1;
 
     /* MODE */
@@ -3743,7 +6029,7 @@ _wbor_draw_bottom(_self)
 	screen_putchar(self->border_chars[WINBORDER_BOTTOM*2-1], row, right+1, attr);
     }
 
-    CLASS_DELETE(writer);
+    writer->op->destroy(writer);
     END_METHOD;
 }
 
@@ -3822,6 +6108,38 @@ _wbor_draw_item_right(_self, line, current)
   // main loop control
   const PULS_LOOP_BREAK	    = 0;
   const PULS_LOOP_CONTINUE  = 1;
+  // the time for a batch of items from a producing model, in milliseconds
+  const PULS_PRODUCE_MSEC   = 20;
+
+  // What redraw drew in a row of the list. The rows that are drawn the same
+  // way again are skipped.
+  struct PulsRow [pulsrow]
+  {
+    int	    idx_model;	  // -1 - empty row, -2 - unknown, the row must be drawn
+    char_u* text;	  // the display text
+    int	    attr;
+    int	    is_current;
+    int	    scroll_kind;  // the scrollbar char in the border, -1 - no scrollbar
+    void    init();
+  };
+
+  // The state that is shared by all the rows of the list. When it changes
+  // every row is redrawn.
+  struct PulsRowsFrame [pulsrfr]
+  {
+    Box	    position;
+    int	    leftcolumn;
+    int	    split_width;  // -1 - the columns are not split
+    int	    menu_mode;
+    int	    revision;	  // the revision of the model items
+    void*   filter_matcher;
+    void*   isearch_matcher;
+    void*   hl_user;	  // NULL if user highlighting is not active
+    char_u  filter_text[MAX_FILTER_SIZE + 1];
+    char_u  isearch_text[MAX_FILTER_SIZE + 1];
+    void    init();
+  };
+
   class PopupList(object) [puls]
   {
     ItemProvider*   model;	// items of the displayed puls
@@ -3852,10 +6170,20 @@ _wbor_draw_item_right(_self, line, current)
     int first;		    // index of top item
     int leftcolumn;	    // first displayed column
     int column_split;	    // TRUE when displayed in two columns split by a tab
-    int col0_width;	    // width of column 0
+    int col0_width;	    // width of column 0; calc_size stops measuring at the size limits
     int col1_width;	    // width of column 1; only valid when column_split is TRUE
     int split_width;	    // the displayed width of column 0; less or eqal to col0_width
     int need_redraw;	    // redraw is needed
+    int coalesce_input;	    // insert all pending typed keys before the input observers are notified
+    int filter_progress;    // redraw the partial results every filter_progress slices; 0 - never
+    int size_sample;	    // the number of items measured by calc_size; 0 - all
+    int autosize;	    // TRUE when the size is calculated from the filtered items
+    int _progress_slices;   // the number of slices reported in the current filter pass
+    PulsRow* _rows;	    // the rows drawn by redraw; NULL if they are not known
+    int	_rows_len;
+    PulsRowsFrame _rows_frame;  // the shared state when the rows were drawn
+    LineHighlightWriter* _writer;   // reused by redraw; its buffer is sized for _writer_columns
+    int	_writer_columns;
 
     void    init();
     void    destroy();
@@ -3864,6 +6192,7 @@ _wbor_draw_item_right(_self, line, current)
     void    default_keymap();
     void    map_keys(char_u* kmap_name, dict_T* kmap);
     int	    calc_size(int limit_width, int limit_height);
+    void    _get_filtered_widths(int limit, int limit0, int* width, int* width0, int* width1);
     void    reposition();
     void    update_hl_chain();
     void    redraw();
@@ -3877,6 +6206,9 @@ _wbor_draw_item_right(_self, line, current)
     void    set_current(int index);
     int	    do_isearch(int dir); // perfrom isearch with the current isearch settings; @param dir=+-1
     int	    on_filter_change(void* data);   // callback to update filter when input changes
+    int	    on_filter_progress(void* data); // callback from a sliced filter pass; nonzero abandons the pass
+    void    resume_filter(int wait);	    // rerun an abandoned filter pass
+    void    produce_items();		    // append a batch of items from a producing model
     int	    on_isearch_change(void* data);  // callback to uptate isearch when input changes
     int	    on_model_title_changed(void* data);  // callback to uptate the title when it changes
 
@@ -3886,6 +6218,29 @@ _wbor_draw_item_right(_self, line, current)
 
 */
 
+    static void
+_pulsrow_init(_self)
+    void* _self;
+    METHOD(PulsRow, init);
+{
+    self->idx_model = -2;
+    self->text = NULL;
+    self->attr = 0;
+    self->is_current = 0;
+    self->scroll_kind = -1;
+    END_METHOD;
+}
+
+    static void
+_pulsrfr_init(_self)
+    void* _self;
+    METHOD(PulsRowsFrame, init);
+{
+    /* the frames are compared with memcmp */
+    vim_memset(self, 0, sizeof(PulsRowsFrame_T));
+    END_METHOD;
+}
+
     static void
 _puls_init(_self)
     void* _self;
@@ -3900,8 +6255,21 @@ _puls_init(_self)
     self->col0_width = 0;
     self->col1_width = 0;
     self->need_redraw = 0;
+    self->coalesce_input = 1;
+    self->filter_progress = 4;
+    self->size_sample = 0;
+    self->autosize = 0;
+    self->_progress_slices = 0;
+    self->_rows = NULL;
+    self->_rows_len = 0;
+    init_PulsRowsFrame(&self->_rows_frame);
+    self->_writer = NULL;
+    self->_writer_columns = 0;
     self->isearch = new_ISearch();
     self->filter = new_ItemFilter();
+    self->filter->slice_size = IFLT_SLICE_SIZE;
+    self->filter->progress.instance_self = self;
+    self->filter->progress.callback = _puls_on_filter_progress;
     self->filter_matcher_name = vim_strsave(VSTR("words"));
     self->isearch_matcher_name = vim_strsave(VSTR("simple"));
     self->filter_matcher_factory = new_TextMatcherFactory();
@@ -3968,6 +6336,8 @@ _puls_destroy(_self)
     CLASS_DELETE(self->isearch);
     CLASS_DELETE(self->filter_matcher_factory)
     CLASS_DELETE(self->isearch_matcher_factory)
+    vim_free(self->_rows);
+    CLASS_DELETE(self->_writer);
 
     END_DESTROY(PopupList);
 }
@@ -4084,6 +6454,63 @@ _puls_read_options(_self, options)
 	    self->filter->op->set_text(self->filter, option->di_tv.vval.v_string);
     }
 
+    /* the memory (in KB) used to remember the results for shorter filter texts */
+    option = dict_find(options, VSTR("filter_history"), -1L);
+    if (option && option->di_tv.v_type == VAR_NUMBER)
+    {
+	if (self->filter)
+	{
+	    self->filter->history_limit = option->di_tv.vval.v_number > 0
+		? (long)option->di_tv.vval.v_number * 1024 : 0;
+	    self->filter->op->clear_history(self->filter);
+	}
+    }
+
+    /* the number of items filtered between the checks for new input; 0 - filter without interruption */
+    option = dict_find(options, VSTR("filter_slice"), -1L);
+    if (option && option->di_tv.v_type == VAR_NUMBER)
+    {
+	if (self->filter)
+	    self->filter->slice_size = option->di_tv.vval.v_number > 0
+		? option->di_tv.vval.v_number : 0;
+    }
+
+    /* redraw the partial results every n slices while filtering; 0 - never */
+    option = dict_find(options, VSTR("filter_progress"), -1L);
+    if (option && option->di_tv.v_type == VAR_NUMBER)
+	self->filter_progress = option->di_tv.vval.v_number;
+
+    /* the number of items measured to find the width of the list; 0 - all */
+    option = dict_find(options, VSTR("size_sample"), -1L);
+    if (option && option->di_tv.v_type == VAR_NUMBER)
+	self->size_sample = option->di_tv.vval.v_number > 0 ? option->di_tv.vval.v_number : 0;
+
+    /* resize the list to fit the filtered items */
+    option = dict_find(options, VSTR("autosize"), -1L);
+    if (option && option->di_tv.v_type == VAR_NUMBER)
+	self->autosize = (option->di_tv.vval.v_number != 0);
+
+    /* insert the typeahead before refiltering and redrawing; 0 - refilter after every key */
+    option = dict_find(options, VSTR("coalesce_input"), -1L);
+    if (option && option->di_tv.v_type == VAR_NUMBER)
+	self->coalesce_input = option->di_tv.vval.v_number;
+
+    /* the number of the best items that are sorted after filtering; 0 - all */
+    option = dict_find(options, VSTR("filter_top_k"), -1L);
+    if (option && option->di_tv.v_type == VAR_NUMBER)
+    {
+	if (self->filter)
+	    self->filter->top_k = option->di_tv.vval.v_number;
+    }
+
+    /* the number of threads that filter large lists; 0 - one per CPU */
+    option = dict_find(options, VSTR("filter_threads"), -1L);
+    if (option && option->di_tv.v_type == VAR_NUMBER)
+    {
+	if (self->filter)
+	    self->filter->threads = option->di_tv.vval.v_number;
+    }
+
     option = dict_find(options, VSTR("highlight"), -1L);
     if (option && option->di_tv.v_type == VAR_STRING && option->di_tv.vval.v_string)
     {
@@ -4282,7 +6709,7 @@ _puls_prepare_result(_self, result)
     int		idx, item_count;
     if (! result)
 	return;
-    idx = self->filter->op->get_model_index(self->filter, self->current);
+    idx = iflt_get_model_index(self->filter, self->current);
     item_count = self->model->op->get_item_count(self->model);
     dict_add_nr_str(result, "current", idx, NULL);
     marked = list_alloc();
@@ -4328,61 +6755,46 @@ _puls_calc_size(_self, limit_width, limit_height)
     int		limit_height;
     METHOD(PopupList, calc_size);
 {
-    int i;
     int w, max_width, max_width_1;
-    char_u *text;
-    char_u *start;
-    char_u *pos;
-    int item_count;
+    int item_count, limit, limit0;
+    int filtered;
 
     limit_width =  limit_value(limit_width, PULS_MIN_WIDTH, Columns-2);
     limit_height = limit_value(limit_height, 1, Rows-2);
-    item_count = self->model->op->get_item_count(self->model);
+    filtered = self->autosize && self->filter && STRLEN(self->filter->text) > 0;
+    item_count = filtered ? iflt_get_item_count(self->filter)
+	: self->model->op->get_item_count(self->model);
     max_width = 0;
     max_width_1 = 0;
 
-    /* TODO: the PULS could be configured for autosize. In this case we would measure
-     * the size of filtered items instead of all items.
-     */
-
-    /* Compute the width of the widest item. */
-    if ( ! self->column_split)
+    /* The items wider than the limits would be clipped, so the measuring
+     * stops when they are reached; the size is the same as if all the items
+     * were measured. */
+    if (! self->column_split)
     {
-	for (i = 0; i < item_count; ++i)
-	{
-	    text = self->model->op->get_display_text(self->model, i);
-	    w = vim_strsize(text);
-	    if (max_width < w)
-		max_width = w;
-	}
-	self->col0_width = max_width;
-	self->col1_width = 0;
+	limit = limit_width;
+	limit0 = 0;
     }
     else
     {
-	for (i = 0; i < item_count; ++i)
-	{
-	    start = self->model->op->get_display_text(self->model, i);
-	    pos = vim_strchr(start, '\t');
-	    if (pos)
-	    {
-		w = vim_strnsize(start, pos-start);
-		if (max_width < w)
-		    max_width = w;
-		w = vim_strsize(pos+1);
-		if (max_width_1 < w)
-		    max_width_1 = w;
-	    }
-	    else
-	    {
-		w = vim_strsize(start);
-		if (max_width < w)
-		    max_width = w;
-	    }
-	}
-	self->col0_width = max_width;
-	self->col1_width = max_width_1;
+	limit = limit_width + 1;
+	limit0 = limit_value((int) (limit_width * 0.4), PULS_MIN_WIDTH, limit_width) - 2;
+    }
+
+    /* The widths of the items are cached by the model. */
+    if (filtered)
+	self->op->_get_filtered_widths(self, limit, limit0, &w, &max_width, &max_width_1);
+    else
+	self->model->op->get_max_widths(self->model,
+		self->size_sample > 0 ? self->size_sample : -1, limit, limit0,
+		&w, &max_width, &max_width_1);
+    if ( ! self->column_split)
+    {
+	max_width = w;
+	max_width_1 = 0;
     }
+    self->col0_width = max_width;
+    self->col1_width = max_width_1;
 
     /* calculate the size within limits */
     self->position.height = limit_value(item_count, 1, limit_height);
@@ -4457,6 +6869,46 @@ _puls_calc_size(_self, limit_width, limit_height)
     END_METHOD;
 }
 
+/*
+ * Like ItemProvider::get_max_widths, but for the items that pass the filter.
+ * The filtered items are visited in the order in which they were scored so
+ * that the results don't have to be sorted.
+ */
+    static void
+_puls__get_filtered_widths(_self, limit, limit0, width, width0, width1)
+    void*	_self;
+    int		limit;
+    int		limit0;
+    int*	width;
+    int*	width0;
+    int*	width1;
+    METHOD(PopupList, _get_filtered_widths);
+{
+    PopupItem_T* pit;
+    int i, count;
+
+    *width = *width0 = *width1 = 0;
+    count = self->filter->items->len;
+    if (self->size_sample > 0 && count > self->size_sample)
+	count = self->size_sample;
+    for (i = 0; i < count; i++)
+    {
+	if (limit > 0 && *width >= limit && *width0 >= limit0)
+	    break;
+	pit = self->model->op->measure_item(self->model,
+		*(int*) sgarr_get_item(self->filter->items, i));
+	if (! pit)
+	    continue;
+	if (*width < pit->width)
+	    *width = pit->width;
+	if (*width0 < pit->width0)
+	    *width0 = pit->width0;
+	if (*width1 < pit->width1)
+	    *width1 = pit->width1;
+    }
+    END_METHOD;
+}
+
     static void
 _puls_reposition(_self)
     void*	_self;
@@ -4478,8 +6930,10 @@ _puls_update_hl_chain(_self)
     void *_self;
     METHOD(PopupList, update_hl_chain);
 {
+    ListHelper_T lst_chain;
     ListHelper_T* plst_chain;
-    plst_chain  = new_ListHelper();
+    plst_chain = &lst_chain;
+    init_ListHelper(plst_chain);
     plst_chain->first = (void**) &self->hl_chain; /* TODO?: lst_chain.set_list() */
     plst_chain->offs_next = offsetof(Highlighter_T, next);
 
@@ -4500,7 +6954,7 @@ _puls_update_hl_chain(_self)
     self->hl_isearch->match_attr = _puls_hl_attrs[PULSATTR_HL_SEARCH].attr;
     plst_chain->op->add_tail(plst_chain, self->hl_isearch);
 
-    CLASS_DELETE(plst_chain);
+    plst_chain->op->destroy(plst_chain);
     END_METHOD;
 }
 
@@ -4517,14 +6971,16 @@ _puls_redraw(_self)
     int		attr_norm   = _puls_hl_attrs[PULSATTR_NORMAL].attr;
     int		attr_select = _puls_hl_attrs[PULSATTR_SELECTED].attr;
     int		menu_mode;
-    char_u	*text;
     int		item_count;
     LineHighlightWriter_T* lhwriter;
     LineWriter_T* writer;
     int		hidden, blank, scrollbar;
+    PulsRow_T	rowstate;
+    PulsRow_T	*prow;
+    PulsRowsFrame_T frame;
 
 
-    item_count = self->filter->op->get_item_count(self->filter);
+    item_count = iflt_get_item_count(self->filter);
 
     hidden = item_count - self->position.height;
     blank = 0;
@@ -4551,7 +7007,14 @@ _puls_redraw(_self)
 	self->hl_menu->active = self->model->has_shortcuts;
 
     self->op->update_hl_chain(self); /* TODO: update when really needed */
-    lhwriter = new_LineHighlightWriter();
+    if (self->_writer && self->_writer_columns != Columns)
+	CLASS_DELETE(self->_writer);
+    if (! self->_writer)
+    {
+	self->_writer = new_LineHighlightWriter();
+	self->_writer_columns = Columns;
+    }
+    lhwriter = self->_writer;
     lhwriter->highlighters = self->hl_chain;
     menu_mode = self->hl_menu && self->hl_menu->active;
 
@@ -4564,12 +7027,72 @@ _puls_redraw(_self)
     if (self->column_split)
 	writer->op->add_fixed_tab(writer, self->split_width);
 
+    /* The rows that are drawn the same way as the last time are skipped.
+     * All the rows are drawn when the screen was cleared or when anything
+     * that affects every row changed. */
+    init_PulsRowsFrame(&frame);
+    frame.position = self->position;
+    frame.leftcolumn = self->leftcolumn;
+    frame.split_width = self->column_split ? self->split_width : -1;
+    frame.menu_mode = menu_mode;
+    frame.revision = self->model->revision;
+    frame.filter_matcher = self->filter->matcher;
+    frame.isearch_matcher = self->isearch->matcher;
+    frame.hl_user = (self->hl_user && self->hl_user->active) ? self->hl_user : NULL;
+    STRCPY(frame.filter_text, self->filter->text);
+    STRCPY(frame.isearch_text, self->isearch->text);
+    if ((self->need_redraw & (PULS_REDRAW_CLEAR | PULS_REDRAW_RESIZE))
+	    || self->_rows_len != self->position.height
+	    || memcmp(&frame, &self->_rows_frame, sizeof(frame)) != 0)
+    {
+	if (self->_rows_len != self->position.height)
+	{
+	    vim_free(self->_rows);
+	    self->_rows_len = 0;
+	    self->_rows = (PulsRow_T*) alloc(self->position.height * sizeof(PulsRow_T));
+	    if (self->_rows)
+		self->_rows_len = self->position.height;
+	}
+	for (i = 0; i < self->_rows_len; ++i)
+	    init_PulsRow(&self->_rows[i]);
+	self->_rows_frame = frame;
+    }
+
     for (i = 0; i < self->position.height; ++i)
     {
 	idx_filter = i + self->first;
 	is_current = (idx_filter == self->current);
 	attr = is_current ? attr_select : attr_norm;
 
+	init_PulsRow(&rowstate);
+	rowstate.is_current = is_current;
+	rowstate.idx_model = -1;
+	if (self->border->scrollbar_thumb > 0)
+	    rowstate.scroll_kind = self->border->op->get_scrollbar_kind(self->border, i, self->current);
+	if (idx_filter < item_count)
+	{
+	    idx_model = iflt_get_model_index(self->filter, idx_filter);
+	    rowstate.idx_model = idx_model;
+	    if (self->model->op->has_flag(self->model, idx_model, ITEM_SEPARATOR))
+		/* pass */;
+	    else if (self->model->op->has_flag(self->model, idx_model, ITEM_DISABLED))
+		attr = _puls_hl_attrs[is_current ? PULSATTR_DISABLED_SEL : PULSATTR_DISABLED].attr;
+	    else if (self->model->op->has_flag(self->model, idx_model, ITEM_MARKED))
+		attr = _puls_hl_attrs[is_current ? PULSATTR_MARKED_SEL : PULSATTR_MARKED].attr;
+	    else if (self->model->op->has_flag(self->model, idx_model, ITEM_TITLE))
+		attr = _puls_hl_attrs[is_current ? PULSATTR_TITLE_SEL : PULSATTR_TITLE].attr;
+	    rowstate.text = self->model->op->get_display_text(self->model, idx_model);
+	}
+	rowstate.attr = attr;
+
+	prow = self->_rows ? &self->_rows[i] : NULL;
+	if (prow && prow->idx_model == rowstate.idx_model && prow->text == rowstate.text
+		&& prow->attr == rowstate.attr && prow->is_current == rowstate.is_current
+		&& prow->scroll_kind == rowstate.scroll_kind)
+	    continue;
+	if (prow)
+	    *prow = rowstate;
+
 	self->border->op->draw_item_left(self->border, i, self->current);
 	row = self->position.top + i;
 	col = self->position.left;
@@ -4580,8 +7103,6 @@ _puls_redraw(_self)
 	    continue;
 	}
 
-	idx_model = self->filter->op->get_model_index(self->filter, idx_filter);
-
 	if (self->model->op->has_flag(self->model, idx_model, ITEM_SEPARATOR))
 	{
 	    /* TODO: separator char setting; maybe as a part of border? */
@@ -4589,13 +7110,6 @@ _puls_redraw(_self)
 	}
 	else
 	{
-	    if (self->model->op->has_flag(self->model, idx_model, ITEM_DISABLED))
-		attr = _puls_hl_attrs[is_current ? PULSATTR_DISABLED_SEL : PULSATTR_DISABLED].attr;
-	    else if (self->model->op->has_flag(self->model, idx_model, ITEM_MARKED))
-		attr = _puls_hl_attrs[is_current ? PULSATTR_MARKED_SEL : PULSATTR_MARKED].attr;
-	    else if (self->model->op->has_flag(self->model, idx_model, ITEM_TITLE))
-		attr = _puls_hl_attrs[is_current ? PULSATTR_TITLE_SEL : PULSATTR_TITLE].attr;
-
 	    if (menu_mode)
 	    {
 		if (self->model->op->has_flag(self->model, idx_model, ITEM_DISABLED))
@@ -4605,16 +7119,13 @@ _puls_redraw(_self)
 			_puls_hl_attrs[is_current ? PULSATTR_SHORTCUT_SEL : PULSATTR_SHORTCUT].attr;
 	    }
 
-	    text = self->model->op->get_display_text(self->model, idx_model);
-	    writer->op->write_line(writer, text, row, attr, ' ');
+	    writer->op->write_line(writer, rowstate.text, row, attr, ' ');
 	}
 
 	self->border->op->draw_item_right(self->border, i, self->current);
     }
     self->border->op->draw_bottom(self->border);
     self->need_redraw = 0;
-
-    CLASS_DELETE(writer);
     END_METHOD;
 }
 
@@ -4652,7 +7163,7 @@ _puls_set_current(_self, index)
     int index;
     METHOD(PopupList, set_current);
 {
-    int item_count = self->filter->op->get_item_count(self->filter);
+    int item_count = iflt_get_item_count(self->filter);
     if (index < 0)
 	index = 0;
     if (index >= item_count)
@@ -4687,7 +7198,8 @@ _puls_refilter(_self, track_item, always_track)
 {
     int item_count;
 
-    item_count = self->filter->op->get_item_count(self->filter);
+    item_count = iflt_get_item_count(self->filter);
+    self->_progress_slices = 0;
     self->filter->op->filter_items(self->filter);
 
     /* Track the position of the current item and try to find it in the
@@ -4695,8 +7207,8 @@ _puls_refilter(_self, track_item, always_track)
      * number of matching items grows. */
     if (track_item >= 0)
     {
-	if (always_track || item_count <= self->filter->op->get_item_count(self->filter))
-	    track_item = self->filter->op->get_index_of(self->filter, track_item);
+	if (always_track || item_count <= iflt_get_item_count(self->filter))
+	    track_item = iflt_get_index_of(self->filter, track_item);
 	else
 	    track_item = 0;
     }
@@ -4712,7 +7224,7 @@ _puls_on_filter_change(_self, data)
 {
     int icur;
 
-    icur = self->filter->op->get_model_index(self->filter, self->current);
+    icur = iflt_get_model_index(self->filter, self->current);
 
     self->filter->op->set_text(self->filter, self->line_edit->text);
 
@@ -4720,7 +7232,8 @@ _puls_on_filter_change(_self, data)
     self->op->set_current(self, icur);
 
     self->need_redraw |= PULS_REDRAW_ALL;
-    /* TODO: if (autosize) pplist->need_redraw |= PULS_REDRAW_RESIZE; */
+    if (self->autosize)
+	self->need_redraw |= PULS_REDRAW_RESIZE;
 
     return 1;
     END_METHOD;
@@ -4737,7 +7250,7 @@ _puls_do_isearch(_self, dir)
     if (! self->filter || ! self->isearch)
 	return 0;
 
-    item_count = self->filter->op->get_item_count(self->filter);
+    item_count = iflt_get_item_count(self->filter);
     start = self->isearch->start;
     if (dir > 0)
     {
@@ -4762,7 +7275,7 @@ _puls_do_isearch(_self, dir)
     {
 	for(i = start; i != end + dir; i += dir)
 	{
-	    idx_model = self->filter->op->get_model_index(self->filter, i);
+	    idx_model = iflt_get_model_index(self->filter, i);
 	    text = self->model->op->get_display_text(self->model, idx_model);
 	    if (self->isearch->op->match(self->isearch, text))
 	    {
@@ -4804,8 +7317,8 @@ _puls_do_command(_self, command)
     char_u* command;
     METHOD(PopupList, do_command);
 {
-    int item_count = self->filter->op->get_item_count(self->filter);
-    int idx_model_current = self->filter->op->get_model_index(self->filter, self->current);
+    int item_count = iflt_get_item_count(self->filter);
+    int idx_model_current = iflt_get_model_index(self->filter, self->current);
 
     int horz_step = self->position.width / 2; /* TODO: horz_step could be configurable */
     if (horz_step < PULS_MIN_WIDTH / 2)
@@ -5098,6 +7611,25 @@ _nextkey()
     return avail;
 }
 
+/*
+ * Wait for at most msec milliseconds for a key. Unlike do_sleep() the wait
+ * ends as soon as input is available.
+ * @returns the next key like _nextkey() or NUL on timeout.
+ */
+    static int
+_waitkey(msec)
+    long msec;
+{
+    int avail;
+    avail = _nextkey();
+    if (avail == NUL && msec > 0)
+    {
+	ui_delay(msec, FALSE);
+	avail = _nextkey();
+    }
+    return avail;
+}
+
     static void
 _forced_redraw()
 {
@@ -5115,6 +7647,109 @@ _forced_redraw()
     out_flush();
 }
 
+/*
+ * Called between the slices of a filter pass. The pass is abandoned when new
+ * input is available. Every filter_progress slices the best items found so
+ * far are displayed.
+ */
+    static int
+_puls_on_filter_progress(_self, data)
+    void* _self;
+    void* data;
+    METHOD(PopupList, on_filter_progress);
+{
+    ItemFilter_T* pfilter = (ItemFilter_T*) data;
+    char_u buf[32];
+
+    if (got_int || _nextkey() != NUL)
+	return 1;
+
+    ++self->_progress_slices;
+    if (self->filter_progress < 1 || self->_progress_slices % self->filter_progress != 0)
+	return 0;
+    if (! self->border)
+	return 0;
+
+    if (pfilter->partial)
+    {
+	iflt_sort_partial(pfilter);
+	self->op->redraw(self);
+    }
+    vim_snprintf((char*)buf, sizeof(buf), "filtering... %d%%",
+	    (int)((long)pfilter->scan_done * 100 / pfilter->scan_total));
+    self->border->op->set_info(self->border, buf);
+    self->border->op->draw_bottom(self->border);
+    self->op->move_cursor(self);
+    out_flush();
+    return 0;
+    END_METHOD;
+}
+
+/*
+ * Rerun a filter pass that was abandoned because of new input. With wait set
+ * the pass is not interrupted, eg. when a command needs all the items.
+ */
+    static void
+_puls_resume_filter(_self, wait)
+    void* _self;
+    int wait;
+    METHOD(PopupList, resume_filter);
+{
+    int icur, slice_size;
+
+    if (! self->filter->interrupted)
+	return;
+
+    slice_size = self->filter->slice_size;
+    if (wait)
+	self->filter->slice_size = 0;
+    icur = iflt_get_model_index(self->filter, self->current);
+    icur = self->op->refilter(self, icur, 0);
+    self->op->set_current(self, icur);
+    self->filter->slice_size = slice_size;
+
+    self->need_redraw |= PULS_REDRAW_ALL;
+    END_METHOD;
+}
+
+/*
+ * Append a batch of items while the model is producing them. The new items
+ * are filtered and the current item keeps its place. The list is cleared and
+ * redrawn only when the new items change its size.
+ */
+    static void
+_puls_produce_items(_self)
+    void* _self;
+    METHOD(PopupList, produce_items);
+{
+    Box_T oldpos;
+    int icur;
+
+    icur = iflt_get_model_index(self->filter, self->current);
+    if (self->model->op->produce_items(self->model, PULS_PRODUCE_MSEC) < 1)
+    {
+	/* update the info in the border */
+	self->need_redraw |= PULS_REDRAW_FRAME;
+	return;
+    }
+
+    if (self->filter->op->is_active(self->filter))
+    {
+	self->_progress_slices = 0;
+	self->filter->op->filter_appended(self->filter);
+	if (icur >= 0)
+	    icur = iflt_get_index_of(self->filter, icur);
+	self->op->set_current(self, icur >= 0 ? icur : 0);
+    }
+
+    oldpos = self->position;
+    self->op->reposition(self);
+    if (memcmp(&oldpos, &self->position, sizeof(Box_T)) != 0)
+	self->need_redraw |= PULS_REDRAW_CLEAR;
+    self->need_redraw |= PULS_REDRAW_ALL;
+    END_METHOD;
+}
+
     static void
 _puls_switch_mode(_self, modename)
     void* _self;
@@ -5198,7 +7833,7 @@ _puls_process_command(_self, command)
     else if (EQUALS(command, cmd_accept))
     {
 	int cont;
-	int idx_model = self->filter->op->get_model_index(self->filter, self->current);
+	int idx_model = iflt_get_model_index(self->filter, self->current);
 
 	if (pmodel->op->has_flag(pmodel, idx_model, ITEM_DISABLED | ITEM_SEPARATOR))
 	    return PULS_LOOP_CONTINUE;
@@ -5231,7 +7866,7 @@ _puls_process_command(_self, command)
     }
     else if (STARTSWITH(command, "accept:"))
     {
-	int idx_model = self->filter->op->get_model_index(self->filter, self->current);
+	int idx_model = iflt_get_model_index(self->filter, self->current);
 
 	if (pmodel->op->has_flag(pmodel, idx_model, ITEM_DISABLED | ITEM_SEPARATOR))
 	    return PULS_LOOP_CONTINUE;
@@ -5278,8 +7913,10 @@ _puls_test_loop(pplist, rettv)
     char_u *ps;
     char_u* command;
     int rv, seq_len, key, found, prev_found, hh, de;
-    int avail, sleep_count;
-    int ambig_timeout;
+    int avail;
+    long ambig_timeout, elapsed;
+    long_u ambig_start;	/* when the sequence became ambiguous */
+    int input_changed;	/* text was inserted but the observers were not notified */
     CommandQueue_T* curcmds;
     SimpleKeymap_T *modemap;
     ItemProvider_T *pmodel;
@@ -5312,7 +7949,7 @@ _puls_test_loop(pplist, rettv)
     hh = pplist->position.height / 2;
     if (pplist->current > hh)
     {
-	de = pfilter->op->get_item_count(pfilter) - pplist->current;
+	de = iflt_get_item_count(pfilter) - pplist->current;
 	if (de < hh)
 	    hh = pplist->position.height - de;
 	pplist->first = pplist->current - hh;
@@ -5324,65 +7961,84 @@ _puls_test_loop(pplist, rettv)
     *ps = NUL;
     pplist->need_redraw = PULS_REDRAW_ALL;
     found = KM_NOTFOUND;
-    sleep_count = 0;
+    ambig_start = 0;
     ambig_timeout = 0;
+    input_changed = FALSE;
     for (;;)
     {
 	modemap = pplist->modemap;
-	if (pborder)
+
+	/* Typeahead coalescing: while more keys are pending, inserted text is
+	 * only collected in line_edit. Refiltering and redrawing are done once
+	 * for the final text. */
+	if (input_changed && !(pplist->coalesce_input && _nextkey() != NUL))
 	{
-	    int nf = pfilter->op->get_item_count(pfilter);
-	    int nt = pmodel->op->get_item_count(pmodel);
-	    char* pending;
-	    pending = (found & KM_PREFIX) ? (char*)sequence : NULL;
-	    if (nf == nt)
-		vim_snprintf((char*)buf, BUF_LEN, "%d/%d%s%s", pplist->current + 1, nt,
-			pending ? " " : "", pending ? pending : "");
-	    else
-		vim_snprintf((char*)buf, BUF_LEN, "%d/%d(%d)%s%s", pplist->current + 1, nf, nt,
-			pending ? " " : "", pending ? pending : "");
-	    pborder->op->set_info(pborder, buf);
-	    if (pplist->need_redraw)
+	    pplist->line_edit->change_obsrvrs.op->notify(&pplist->line_edit->change_obsrvrs, NULL);
+	    input_changed = FALSE;
+	}
+	/* a filter pass that was abandoned because of new input is resumed
+	 * when the input was processed */
+	if (!input_changed && pfilter->interrupted && _nextkey() == NUL)
+	    pplist->op->resume_filter(pplist, FALSE);
+	if (!input_changed)
+	{
+	    if (pborder)
 	    {
-		if (modemap && pborder->input_active)
+		int nf = iflt_get_item_count(pfilter);
+		int nt = pmodel->op->get_item_count(pmodel);
+		char* pending;
+		char* more;
+		pending = (found & KM_PREFIX) ? (char*)sequence : NULL;
+		more = pmodel->producing ? "+" : "";
+		if (nf == nt)
+		    vim_snprintf((char*)buf, BUF_LEN, "%d/%d%s%s%s", pplist->current + 1, nt, more,
+			    pending ? " " : "", pending ? pending : "");
+		else
+		    vim_snprintf((char*)buf, BUF_LEN, "%d/%d(%d%s)%s%s", pplist->current + 1, nf, nt, more,
+			    pending ? " " : "", pending ? pending : "");
+		pborder->op->set_info(pborder, buf);
+		if (pplist->need_redraw)
 		{
-		    TextMatcher_T* ptm = NULL;
-		    if (modemap == pplist->km_filter)
-			ptm = pfilter->matcher;
-		    else if (modemap == pplist->km_search)
-			ptm = pplist->isearch->matcher;
-		    if (ptm)
-			sprintf((char*)buf, "%c%c", ptm->mode_char, modemap->mode_char);
+		    if (modemap && pborder->input_active)
+		    {
+			TextMatcher_T* ptm = NULL;
+			if (modemap == pplist->km_filter)
+			    ptm = pfilter->matcher;
+			else if (modemap == pplist->km_search)
+			    ptm = pplist->isearch->matcher;
+			if (ptm)
+			    sprintf((char*)buf, "%c%c", ptm->mode_char, modemap->mode_char);
+			else
+			    sprintf((char*)buf, " %c", modemap->mode_char);
+		    }
+		    else if (modemap == pplist->km_shortcut)
+			sprintf((char*)buf, "&&");
 		    else
-			sprintf((char*)buf, " %c", modemap->mode_char);
+			buf[0] = NUL;
+		    pborder->op->set_mode_text(pborder, buf);
 		}
-		else if (modemap == pplist->km_shortcut)
-		    sprintf((char*)buf, "&&");
-		else
-		    buf[0] = NUL;
-		pborder->op->set_mode_text(pborder, buf);
 	    }
+	    if (pplist->need_redraw & PULS_REDRAW_CLEAR)
+	    {
+		_forced_redraw();
+		pplist->op->redraw(pplist);
+	    }
+	    else if (pplist->need_redraw & PULS_REDRAW_RESIZE)
+	    {
+		_forced_redraw();
+		pplist->op->reposition(pplist);
+		pplist->op->redraw(pplist);
+	    }
+	    else if (pplist->need_redraw & PULS_REDRAW_ALL)
+	    {
+		pplist->op->redraw(pplist);
+	    }
+	    else if (pborder)
+	    {
+		pborder->op->draw_bottom(pborder);
+	    }
+	    pplist->op->move_cursor(pplist);
 	}
-	if (pplist->need_redraw & PULS_REDRAW_CLEAR)
-	{
-	    _forced_redraw();
-	    pplist->op->redraw(pplist);
-	}
-	else if (pplist->need_redraw & PULS_REDRAW_RESIZE)
-	{
-	    _forced_redraw();
-	    pplist->op->reposition(pplist);
-	    pplist->op->redraw(pplist);
-	}
-	else if (pplist->need_redraw & PULS_REDRAW_ALL)
-	{
-	    pplist->op->redraw(pplist);
-	}
-	else if (pborder)
-	{
-	    pborder->op->draw_bottom(pborder);
-	}
-	pplist->op->move_cursor(pplist);
 
 	/* Command processing:
 	 *    - queued kbd commands are processed immediately,
@@ -5398,6 +8054,14 @@ _puls_test_loop(pplist, rettv)
 	}
 	else if (pplist->cmds_macro->op->head(pplist->cmds_macro) && !avail)
 	{/* pass */}
+	else if (pmodel->producing && !avail && found != KM_AMBIGUOUS)
+	{
+	    /* the items are appended while the user is not typing */
+	    if (got_int)
+		break;
+	    pplist->op->produce_items(pplist);
+	    continue;
+	}
 	else
 	{
 	    if (found == KM_AMBIGUOUS)
@@ -5405,24 +8069,26 @@ _puls_test_loop(pplist, rettv)
 		if (got_int)
 		    break;
 
-		/* wait for next character or a timeout */
-		avail = (_nextkey() != NUL);
-		if (!avail && sleep_count < ambig_timeout)
+		/* wait for the next character until the timeout expires */
+		elapsed = (long)(_clock_ms() - ambig_start);
+		avail = (_waitkey(ambig_timeout - elapsed) != NUL);
+		if (!avail)
 		{
-		    do_sleep(20);
-		    sleep_count += 20;
-		    continue;
+		    /* the wait can also end on events that are not keys */
+		    elapsed = (long)(_clock_ms() - ambig_start);
+		    if (elapsed < ambig_timeout)
+			continue;
 		}
 		if (!avail)
 		{
-		    LOG(("found = KM_AMBIGUOUS, end of sleep %d", sleep_count));
+		    LOG(("found = KM_AMBIGUOUS, end of wait %ld", elapsed));
 		    prev_found = KM_PREFIX;
 		    found = KM_MATCH;
 		    LOG(("   found -> KM_MATCH, '%s'", sequence));
 		}
 		else
 		{
-		    LOG(("found = KM_AMBIGUOUS, GOT SOMETHING! slept: %d, key: %d", sleep_count, avail));
+		    LOG(("found = KM_AMBIGUOUS, GOT SOMETHING! waited: %ld, key: %d", elapsed, avail));
 		    key = _getkey();
 		    ps = key_to_str(key, ps);
 		    prev_found = KM_PREFIX;
@@ -5472,8 +8138,8 @@ _puls_test_loop(pplist, rettv)
 		found = modemap->op->find_key(modemap, sequence);
 		if (found == KM_AMBIGUOUS)
 		{
-		    LOG(("found -> KM_AMBIGUOUS, sleep_count=0"));
-		    sleep_count = 0;
+		    LOG(("found -> KM_AMBIGUOUS, start the timeout"));
+		    ambig_start = _clock_ms();
 		    /* use timeoutlen or ttimeoutlen */
 		    ambig_timeout = (p_ttm < 0 ? p_tm : p_ttm);
 		    /* XXX: In console a timeout for <esc> is applied twice.
@@ -5508,7 +8174,7 @@ _puls_test_loop(pplist, rettv)
 		if (modemap->has_insert && prev_found != KM_PREFIX && !IS_SPECIAL(key))
 		{
 		    if (pplist->line_edit->op->add_text(pplist->line_edit, sequence))
-			pplist->line_edit->change_obsrvrs.op->notify(&pplist->line_edit->change_obsrvrs, NULL);
+			input_changed = TRUE;
 		}
 		ps = sequence;
 		*ps = NUL;
@@ -5534,6 +8200,20 @@ _puls_test_loop(pplist, rettv)
 	    curcmds = NULL;
 	if (curcmds)
 	{
+	    /* Commands work with the filtered items. The commands that edit the
+	     * input notify the observers themselves; their refilter replaces the
+	     * pending and the abandoned passes. */
+	    if (STARTSWITH(curcmds->op->head(curcmds), "input-"))
+		input_changed = FALSE;
+	    else
+	    {
+		if (input_changed)
+		{
+		    pplist->line_edit->change_obsrvrs.op->notify(&pplist->line_edit->change_obsrvrs, NULL);
+		    input_changed = FALSE;
+		}
+		pplist->op->resume_filter(pplist, TRUE);
+	    }
 	    rv = pplist->op->process_command(pplist, curcmds->op->head(curcmds));
 	    if (rv == PULS_LOOP_BREAK)
 		break;
@@ -5608,6 +8288,11 @@ _puls_test_loop(pplist, rettv)
  *	    The placement of the popup window.
  *	options.mode
  *	    The popuplist mode to start with.
+ *	options.file
+ *	    The file with the paths for the "filelist" items, one per line. Only
+ *	    a file with NUL-separated paths (find -print0) is mapped and
+ *	    displayed without copying; a file with newlines is read into
+ *	    memory.
  *	// options.filter
  *	//    The filtering algorithm.
  *
@@ -5712,6 +8397,30 @@ puls_test(argvars, rettv)
 	    default_split_columns = 1;
 	}
 #endif
+#ifdef FEAT_POPUPLIST_FILELIST
+	if (EQUALS(special_items, "filelist"))
+	{
+	    MappedFileItemProvider_T* mfmodel = new_MappedFileItemProvider();
+	    LOG(("File list"));
+	    option = options ? dict_find(options, VSTR("file"), -1L) : NULL;
+	    if (! option || option->di_tv.v_type != VAR_STRING
+		    || ! option->di_tv.vval.v_string
+		    || mfmodel->op->map_file(mfmodel, option->di_tv.vval.v_string) == FAIL)
+	    {
+		CLASS_DELETE(mfmodel);
+		/* TODO: errmsg: can't read the file list */
+		return FAIL;
+	    }
+	    model = (ItemProvider_T*) mfmodel;
+	}
+#endif
+#ifdef FEAT_POPUPLIST_FILES
+	if (EQUALS(special_items, "files"))
+	{
+	    LOG(("Files"));
+	    model = (ItemProvider_T*) new_FileItemProvider();
+	}
+#endif
 #ifdef FEAT_QUICKFIX
 	if (EQUALS(special_items, "quickfix") || EQUALS(special_items, "copen"))
 	{
@@ -5753,6 +8462,10 @@ puls_test(argvars, rettv)
 	{
 	    _test_list_helper();
 	    _test_command_t();
+	    _test_command_t_dp();
+	    _test_stristr_speed();
+	    _test_filter_narrowing();
+	    _test_fold_cache();
 	    special_items = str_pulslog;
 	}
 #endif
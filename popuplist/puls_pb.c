@@ -82,6 +82,7 @@ _bprov_read_options(_self, options)
     METHOD(BufferItemProvider, read_options);
 {
     dictitem_T* option;
+    super(BufferItemProvider, read_options)(self, options);
 
     option = dict_find(options, VSTR("unlisted"), -1L);
     if (option && option->di_tv.v_type == VAR_NUMBER)
@@ -177,7 +178,7 @@ _bprov_list_buffers(_self)
 			(bufIsChanged(buf) ? '+' : ' '),
 		fname, dirname);
 
-	pit = self->op->append_pchar_item(self, vim_strsave(IObuff), !ITEM_SHARED);
+	pit = self->op->append_pchar_item(self, IObuff, ITEM_ARENA);
 	if (pit)
 	{
 	    pit->data = (void *)buf;
@@ -189,6 +190,7 @@ _bprov_list_buffers(_self)
 		++pit->filter_start;
 		i *= 10;
 	    }
+	    pit->char_mask = _str_char_mask(pit->text + pit->filter_start);
 	}
     }
     END_METHOD;
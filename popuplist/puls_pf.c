@@ -0,0 +1,740 @@
+/* vi:set ts=8 sts=4 sw=4 noet list:vi
+ *
+ * VIM - Vi IMproved	by Bram Moolenaar
+ *                      Popup List by Marko Mahnič
+ *
+ * Do ":help uganda"  in Vim to read copying and usage conditions.
+ * Do ":help credits" in Vim to see a list of people who contributed.
+ * See README.txt for an overview of the Vim source code.
+ */
+
+/*
+ * puls_pf.c: Provider that lists the files in a directory tree for the Popup
+ * list (PULS). The tree is walked by worker threads while the list is
+ * displayed.
+ * NOTE: this file is included by popuplist.c
+ *
+ * Copyright © 2011 Marko Mahnič.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <dirent.h>
+#include <fnmatch.h>
+
+/* [ooc]
+ *
+  const FWALK_MAX_THREADS = 16;
+  const FWALK_BLOCK_SIZE  = 16384;  // the size of the text in a FileBlock
+  const FWALK_STOP_CHECK  = 256;    // the entries read between the checks of _stop
+
+  // A block of paths found by a worker. The paths are stored one after
+  // another in text, each terminated with a NUL.
+  struct FileBlock [fblk, variant FEAT_POPUPLIST_FILES]
+  {
+    FileBlock*	next;
+    char*	text;
+    int		len;	    // the number of bytes used in text
+    void	init();
+  };
+
+  // Walks a directory tree with a pool of threads. The directories that wait
+  // to be read are on a stack shared by the workers; the paths of the files
+  // are collected in blocks that the main thread gets with take_blocks.
+  // The workers don't call Vim functions: the memory is allocated with
+  // malloc() and the ignore patterns are matched with fnmatch().
+  class FileWalker [fwalk, variant FEAT_POPUPLIST_FILES]
+  {
+    char**	ignore;	    // fnmatch() patterns; NULL-terminated
+    int		ignore_count;
+    int		hidden;	    // TRUE - walk the hidden files and directories
+    int		threads;    // 0 - one per CPU; 1 - the directories are read in take_blocks
+
+    pthread_mutex_t _mutex;
+    pthread_cond_t  _work_cond;	    // a directory was pushed or the walk is over
+    pthread_cond_t  _ready_cond;    // a block is ready or the walk is over
+    pthread_t	_workers[FWALK_MAX_THREADS];
+    int		_nworkers;
+    char**	_dirs;	    // the directories to read
+    int		_dirs_len;
+    int		_dirs_size;
+    int		_active;    // the number of directories being read
+    int		_stop;
+    FileBlock*	_ready;	    // the blocks for the main thread, the oldest first
+    FileBlock*	_ready_last;
+
+    void	init();
+    void	destroy();
+    void	add_ignore(char_u* pattern);
+    int		start(char_u* root);
+    void	stop();
+    int		is_done();
+    FileBlock*	take_blocks(long msec);
+    int		_is_ignored(char* name, char* path);
+    int		_is_stopped();
+    void	_read_dir(char* dir);
+    void	_publish(FileBlock* block, char** dirs, int ndirs);
+    void	_run();
+  };
+
+  class FileItemProvider(ItemProvider) [flprov, variant FEAT_POPUPLIST_FILES]
+  {
+    FileWalker*	walker;
+    char_u*	root;	    // "~" and environment variables are expanded in on_start
+
+    void	init();
+    void	destroy();
+    void	read_options(dict_T* options);
+    void	on_start();
+    int		produce_items(long msec);
+    char_u*	get_title();
+  };
+*/
+
+    static void
+_fblk_init(_self)
+    void* _self;
+    METHOD(FileBlock, init);
+{
+    self->next = NULL;
+    self->text = NULL;
+    self->len = 0;
+    END_METHOD;
+}
+
+    static void
+_fblk_free(pblock)
+    FileBlock_T* pblock;
+{
+    FileBlock_T* pnext;
+    while (pblock)
+    {
+	pnext = pblock->next;
+	free(pblock->text);
+	free(pblock);
+	pblock = pnext;
+    }
+}
+
+    static void
+_fwalk_init(_self)
+    void* _self;
+    METHOD(FileWalker, init);
+{
+    self->ignore = NULL;
+    self->ignore_count = 0;
+    self->hidden = 0;
+    self->threads = 0;
+    pthread_mutex_init(&self->_mutex, NULL);
+    pthread_cond_init(&self->_work_cond, NULL);
+    pthread_cond_init(&self->_ready_cond, NULL);
+    self->_nworkers = 0;
+    self->_dirs = NULL;
+    self->_dirs_len = 0;
+    self->_dirs_size = 0;
+    self->_active = 0;
+    self->_stop = 0;
+    self->_ready = NULL;
+    self->_ready_last = NULL;
+    END_METHOD;
+}
+
+    static void
+_fwalk_destroy(_self)
+    void* _self;
+    METHOD(FileWalker, destroy);
+{
+    int i;
+
+    self->op->stop(self);
+    for (i = 0; i < self->ignore_count; i++)
+	vim_free(self->ignore[i]);
+    vim_free(self->ignore);
+    self->ignore = NULL;
+    pthread_mutex_destroy(&self->_mutex);
+    pthread_cond_destroy(&self->_work_cond);
+    pthread_cond_destroy(&self->_ready_cond);
+    END_DESTROY(FileWalker);
+}
+
+/*
+ * Add a pattern for the files and directories that are skipped. A pattern
+ * with a slash is matched against the path, the others against the name.
+ * Can only be called before start().
+ */
+    static void
+_fwalk_add_ignore(_self, pattern)
+    void* _self;
+    char_u* pattern;
+    METHOD(FileWalker, add_ignore);
+{
+    char** pnew;
+
+    if (! pattern)
+	return;
+    pnew = (char**) vim_realloc(self->ignore, (self->ignore_count + 2) * sizeof(char*));
+    if (! pnew)
+	return;
+    self->ignore = pnew;
+    self->ignore[self->ignore_count] = NULL;
+    /* an empty pattern only creates an empty list */
+    if (! *pattern)
+	return;
+    self->ignore[self->ignore_count] = (char*) vim_strsave(pattern);
+    if (self->ignore[self->ignore_count])
+	++self->ignore_count;
+    self->ignore[self->ignore_count] = NULL;
+    END_METHOD;
+}
+
+/*
+ * Stop the workers and drop the paths that were not taken.
+ */
+    static void
+_fwalk_stop(_self)
+    void* _self;
+    METHOD(FileWalker, stop);
+{
+    int i;
+
+    pthread_mutex_lock(&self->_mutex);
+    self->_stop = 1;
+    pthread_cond_broadcast(&self->_work_cond);
+    pthread_mutex_unlock(&self->_mutex);
+    for (i = 0; i < self->_nworkers; i++)
+	pthread_join(self->_workers[i], NULL);
+    self->_nworkers = 0;
+
+    for (i = 0; i < self->_dirs_len; i++)
+	free(self->_dirs[i]);
+    free(self->_dirs);
+    self->_dirs = NULL;
+    self->_dirs_len = 0;
+    self->_dirs_size = 0;
+    _fblk_free(self->_ready);
+    self->_ready = NULL;
+    self->_ready_last = NULL;
+    END_METHOD;
+}
+
+/*
+ * @returns TRUE when all the directories were read. Some blocks may still
+ * wait to be taken.
+ */
+    static int
+_fwalk_is_done(_self)
+    void* _self;
+    METHOD(FileWalker, is_done);
+{
+    int done;
+    pthread_mutex_lock(&self->_mutex);
+    done = self->_stop || (self->_dirs_len == 0 && self->_active == 0);
+    pthread_mutex_unlock(&self->_mutex);
+    return done;
+    END_METHOD;
+}
+
+/*
+ * Take the blocks that the workers have filled. If none is ready, wait for
+ * at most msec milliseconds. Without workers the directories are read here
+ * for about msec milliseconds.
+ * @returns a list of blocks that must be freed with _fblk_free().
+ */
+    static FileBlock_T*
+_fwalk_take_blocks(_self, msec)
+    void* _self;
+    long msec;
+    METHOD(FileWalker, take_blocks);
+{
+    FileBlock_T* pblocks;
+    struct timeval tv;
+    struct timespec ts;
+    long_u start;
+    char* dir;
+
+    if (self->_nworkers == 0)
+    {
+	start = _clock_ms();
+	while (self->_dirs_len > 0 && ! self->_stop
+		&& (long)(_clock_ms() - start) < msec)
+	{
+	    dir = self->_dirs[--self->_dirs_len];
+	    self->op->_read_dir(self, dir);
+	    free(dir);
+	}
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+    if (! self->_ready && msec > 0 && self->_nworkers > 0
+	    && (self->_dirs_len > 0 || self->_active > 0))
+    {
+	gettimeofday(&tv, NULL);
+	ts.tv_sec = tv.tv_sec + msec / 1000;
+	ts.tv_nsec = (tv.tv_usec + (msec % 1000) * 1000) * 1000L;
+	if (ts.tv_nsec >= 1000000000L)
+	{
+	    ++ts.tv_sec;
+	    ts.tv_nsec -= 1000000000L;
+	}
+	pthread_cond_timedwait(&self->_ready_cond, &self->_mutex, &ts);
+    }
+    pblocks = self->_ready;
+    self->_ready = NULL;
+    self->_ready_last = NULL;
+    pthread_mutex_unlock(&self->_mutex);
+    return pblocks;
+    END_METHOD;
+}
+
+/*
+ * Called from the workers; must not use Vim's global state.
+ */
+    static int
+_fwalk__is_ignored(_self, name, path)
+    void* _self;
+    char* name;
+    char* path;
+    METHOD(FileWalker, _is_ignored);
+{
+    int i;
+
+    if (! self->hidden && name[0] == '.')
+	return 1;
+    for (i = 0; i < self->ignore_count; i++)
+    {
+	if (strchr(self->ignore[i], '/'))
+	{
+	    if (fnmatch(self->ignore[i], path, 0) == 0)
+		return 1;
+	}
+	else if (fnmatch(self->ignore[i], name, 0) == 0)
+	    return 1;
+    }
+    return 0;
+    END_METHOD;
+}
+
+/*
+ * Called from the workers. _stop is set by the main thread.
+ */
+    static int
+_fwalk__is_stopped(_self)
+    void* _self;
+    METHOD(FileWalker, _is_stopped);
+{
+    int stop;
+    pthread_mutex_lock(&self->_mutex);
+    stop = self->_stop;
+    pthread_mutex_unlock(&self->_mutex);
+    return stop;
+    END_METHOD;
+}
+
+/*
+ * Read a directory. The paths of the files are put into blocks, the
+ * subdirectories are pushed on the stack. The symbolic links are listed but
+ * not followed, so the walk can't loop.
+ */
+    static void
+_fwalk__read_dir(_self, dir)
+    void* _self;
+    char* dir;
+    METHOD(FileWalker, _read_dir);
+{
+    DIR* pdir;
+    struct dirent* pent;
+    struct stat st;
+    FileBlock_T* pblock;
+    char** subdirs;
+    char** pnew;
+    int nsubdirs, subdirs_size, is_dir, prefix_len, len, nentries;
+    char path[MAXPATHL];
+
+    if (self->op->_is_stopped(self))
+	return;
+    pdir = opendir(dir);
+    if (! pdir)
+	return;
+
+    /* the paths in "." are relative */
+    if (dir[0] == '.' && dir[1] == NUL)
+	prefix_len = 0;
+    else
+    {
+	prefix_len = (int) strlen(dir);
+	if (prefix_len >= MAXPATHL - 2)
+	{
+	    closedir(pdir);
+	    return;
+	}
+	memcpy(path, dir, prefix_len);
+	if (prefix_len > 0 && path[prefix_len - 1] != '/')
+	    path[prefix_len++] = '/';
+    }
+
+    pblock = NULL;
+    subdirs = NULL;
+    nsubdirs = 0;
+    subdirs_size = 0;
+    nentries = 0;
+    while ((pent = readdir(pdir)) != NULL)
+    {
+	if (++nentries % FWALK_STOP_CHECK == 0 && self->op->_is_stopped(self))
+	    break;
+	if (pent->d_name[0] == '.' && (pent->d_name[1] == NUL
+		    || (pent->d_name[1] == '.' && pent->d_name[2] == NUL)))
+	    continue;
+	len = (int) strlen(pent->d_name);
+	if (prefix_len + len >= MAXPATHL)
+	    continue;
+	memcpy(path + prefix_len, pent->d_name, len + 1);
+	if (self->op->_is_ignored(self, pent->d_name, path))
+	    continue;
+
+#ifdef DT_DIR
+	if (pent->d_type != DT_UNKNOWN)
+	    is_dir = (pent->d_type == DT_DIR);
+	else
+#endif
+	    is_dir = (lstat(path, &st) == 0 && S_ISDIR(st.st_mode));
+
+	if (is_dir)
+	{
+	    if (nsubdirs >= subdirs_size)
+	    {
+		subdirs_size = subdirs_size ? subdirs_size * 2 : 16;
+		pnew = (char**) realloc(subdirs, subdirs_size * sizeof(char*));
+		if (! pnew)
+		    break;
+		subdirs = pnew;
+	    }
+	    subdirs[nsubdirs] = strdup(path);
+	    if (subdirs[nsubdirs])
+		++nsubdirs;
+	    continue;
+	}
+
+	len += prefix_len + 1;
+	if (pblock && pblock->len + len > FWALK_BLOCK_SIZE)
+	{
+	    self->op->_publish(self, pblock, NULL, 0);
+	    pblock = NULL;
+	}
+	if (! pblock)
+	{
+	    pblock = (FileBlock_T*) malloc(sizeof(FileBlock_T));
+	    if (! pblock)
+		break;
+	    init_FileBlock(pblock);
+	    pblock->text = (char*) malloc(len > FWALK_BLOCK_SIZE ? len : FWALK_BLOCK_SIZE);
+	    if (! pblock->text)
+	    {
+		free(pblock);
+		pblock = NULL;
+		break;
+	    }
+	}
+	memcpy(pblock->text + pblock->len, path, len);
+	pblock->len += len;
+    }
+    closedir(pdir);
+
+    self->op->_publish(self, pblock, subdirs, nsubdirs);
+    free(subdirs);
+    END_METHOD;
+}
+
+/*
+ * Hand a block of paths to the main thread and push the subdirectories for
+ * the workers.
+ */
+    static void
+_fwalk__publish(_self, pblock, dirs, ndirs)
+    void* _self;
+    FileBlock_T* pblock;
+    char** dirs;
+    int ndirs;
+    METHOD(FileWalker, _publish);
+{
+    char** pnew;
+    int size;
+
+    pthread_mutex_lock(&self->_mutex);
+    if (pblock && pblock->len > 0)
+    {
+	if (self->_ready_last)
+	    self->_ready_last->next = pblock;
+	else
+	    self->_ready = pblock;
+	self->_ready_last = pblock;
+	pblock = NULL;
+	pthread_cond_signal(&self->_ready_cond);
+    }
+    if (ndirs > 0 && self->_dirs_len + ndirs > self->_dirs_size)
+    {
+	size = self->_dirs_size * 2;
+	if (size < self->_dirs_len + ndirs)
+	    size = self->_dirs_len + ndirs;
+	pnew = (char**) realloc(self->_dirs, size * sizeof(char*));
+	if (pnew)
+	{
+	    self->_dirs = pnew;
+	    self->_dirs_size = size;
+	}
+    }
+    for (; ndirs > 0; ndirs--, dirs++)
+    {
+	if (self->_dirs_len < self->_dirs_size)
+	    self->_dirs[self->_dirs_len++] = *dirs;
+	else
+	    free(*dirs);
+    }
+    pthread_cond_broadcast(&self->_work_cond);
+    pthread_mutex_unlock(&self->_mutex);
+
+    _fblk_free(pblock);
+    END_METHOD;
+}
+
+/*
+ * The main loop of a worker. It ends when no directory is left and no other
+ * worker is reading one that could have subdirectories.
+ */
+    static void
+_fwalk__run(_self)
+    void* _self;
+    METHOD(FileWalker, _run);
+{
+    char* dir;
+
+    pthread_mutex_lock(&self->_mutex);
+    for (;;)
+    {
+	while (! self->_stop && self->_dirs_len == 0 && self->_active > 0)
+	    pthread_cond_wait(&self->_work_cond, &self->_mutex);
+	if (self->_stop || self->_dirs_len == 0)
+	    break;
+	dir = self->_dirs[--self->_dirs_len];
+	++self->_active;
+	pthread_mutex_unlock(&self->_mutex);
+
+	self->op->_read_dir(self, dir);
+	free(dir);
+
+	pthread_mutex_lock(&self->_mutex);
+	--self->_active;
+    }
+    /* wake the other workers and the main thread waiting for the end */
+    pthread_cond_broadcast(&self->_work_cond);
+    pthread_cond_signal(&self->_ready_cond);
+    pthread_mutex_unlock(&self->_mutex);
+    END_METHOD;
+}
+
+    static void*
+_fwalk_thread_main(arg)
+    void* arg;
+{
+    _fwalk__run(arg);
+    return NULL;
+}
+
+/*
+ * Start walking the tree at root. The workers start reading the directories
+ * immediately. When no thread can be created the directories are read in
+ * take_blocks.
+ * @returns FAIL if the walk can't be started.
+ */
+    static int
+_fwalk_start(_self, root)
+    void* _self;
+    char_u* root;
+    METHOD(FileWalker, start);
+{
+    int nthreads, i;
+
+    self->_dirs = (char**) malloc(16 * sizeof(char*));
+    if (! self->_dirs)
+	return FAIL;
+    self->_dirs_size = 16;
+    self->_dirs[0] = strdup((char*) root);
+    if (! self->_dirs[0])
+	return FAIL;
+    self->_dirs_len = 1;
+
+    nthreads = self->threads;
+#ifdef _SC_NPROCESSORS_ONLN
+    if (nthreads < 1)
+	nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (nthreads > FWALK_MAX_THREADS)
+	nthreads = FWALK_MAX_THREADS;
+    if (nthreads < 2)
+	return OK;
+
+    for (i = 0; i < nthreads; i++)
+    {
+	if (pthread_create(&self->_workers[self->_nworkers], NULL, &_fwalk_thread_main, self) == 0)
+	    ++self->_nworkers;
+    }
+    return OK;
+    END_METHOD;
+}
+
+    static void
+_flprov_init(_self)
+    void* _self;
+    METHOD(FileItemProvider, init);
+{
+    self->walker = new_FileWalker();
+    self->root = NULL;
+    END_METHOD;
+}
+
+    static void
+_flprov_destroy(_self)
+    void* _self;
+    METHOD(FileItemProvider, destroy);
+{
+    CLASS_DELETE(self->walker);
+    vim_free(self->root);
+    END_DESTROY(FileItemProvider);
+}
+
+    static char_u*
+_flprov_get_title(_self)
+    void* _self;
+    METHOD(FileItemProvider, get_title);
+{
+    static char_u title[] = "Files";
+    if (self->title)
+	return self->title;
+    return self->root ? self->root : title;
+    END_METHOD;
+}
+
+    static void
+_flprov_read_options(_self, options)
+    void* _self;
+    dict_T* options;
+    METHOD(FileItemProvider, read_options);
+{
+    dictitem_T* option;
+    listitem_T* pitem;
+    super(FileItemProvider, read_options)(self, options);
+
+    option = dict_find(options, VSTR("root"), -1L);
+    if (option && option->di_tv.v_type == VAR_STRING && option->di_tv.vval.v_string)
+    {
+	vim_free(self->root);
+	self->root = vim_strsave(option->di_tv.vval.v_string);
+    }
+
+    /* the patterns of the ignored files; 'wildignore' is used by default */
+    option = dict_find(options, VSTR("ignore"), -1L);
+    if (option && option->di_tv.v_type == VAR_LIST && option->di_tv.vval.v_list)
+    {
+	for (pitem = option->di_tv.vval.v_list->lv_first; pitem; pitem = pitem->li_next)
+	{
+	    if (pitem->li_tv.v_type == VAR_STRING)
+		self->walker->op->add_ignore(self->walker, pitem->li_tv.vval.v_string);
+	}
+	if (! self->walker->ignore)
+	    self->walker->op->add_ignore(self->walker, VSTR(""));
+    }
+
+    option = dict_find(options, VSTR("hidden"), -1L);
+    if (option && option->di_tv.v_type == VAR_NUMBER)
+	self->walker->hidden = (option->di_tv.vval.v_number != 0);
+
+    option = dict_find(options, VSTR("walk_threads"), -1L);
+    if (option && option->di_tv.v_type == VAR_NUMBER)
+	self->walker->threads = option->di_tv.vval.v_number;
+    END_METHOD;
+}
+
+/*
+ * Start the walk. The items are appended by produce_items while the list is
+ * displayed.
+ */
+    static void
+_flprov_on_start(_self)
+    void* _self;
+    METHOD(FileItemProvider, on_start);
+{
+    char_u root[MAXPATHL];
+#ifdef FEAT_WILDIGNORE
+    char_u *p, *pend;
+    char_u pattern[MAXPATHL];
+    int len;
+#endif
+
+    LOG(("FileItemProvider on_start"));
+#ifdef FEAT_WILDIGNORE
+    if (! self->walker->ignore && p_wig)
+    {
+	for (p = p_wig; *p; p = pend)
+	{
+	    pend = vim_strchr(p, ',');
+	    if (! pend)
+		pend = p + STRLEN(p);
+	    len = (int)(pend - p);
+	    if (len > 0 && len < MAXPATHL)
+	    {
+		vim_strncpy(pattern, p, len);
+		self->walker->op->add_ignore(self->walker, pattern);
+	    }
+	    if (*pend == ',')
+		++pend;
+	}
+    }
+#endif
+
+    /* the workers can't expand "~" or "$HOME" */
+    if (self->root && *self->root)
+	expand_env(self->root, root, MAXPATHL);
+    else
+	STRCPY(root, ".");
+    if (self->walker->op->start(self->walker, root) == OK)
+	self->producing = 1;
+    END_METHOD;
+}
+
+    static int
+_flprov_produce_items(_self, msec)
+    void* _self;
+    long msec;
+    METHOD(FileItemProvider, produce_items);
+{
+    FileBlock_T *pblocks, *pblock;
+    char *p, *pend;
+    int count, done;
+
+    /* the walk may end while the last blocks are taken */
+    done = self->walker->op->is_done(self->walker);
+    pblocks = self->walker->op->take_blocks(self->walker, msec);
+    count = 0;
+    for (pblock = pblocks; pblock; pblock = pblock->next)
+    {
+	pend = pblock->text + pblock->len;
+	for (p = pblock->text; p < pend; p += strlen(p) + 1)
+	{
+	    if (self->op->append_pchar_item(self, (char_u*)p, ITEM_ARENA))
+		++count;
+	}
+    }
+    _fblk_free(pblocks);
+
+    if (done && ! pblocks)
+	self->producing = 0;
+    return count;
+    END_METHOD;
+}
@@ -0,0 +1,262 @@
+/* vi:set ts=8 sts=4 sw=4 noet list:vi
+ *
+ * VIM - Vi IMproved	by Bram Moolenaar
+ *                      Popup List by Marko Mahnič
+ *
+ * Do ":help uganda"  in Vim to read copying and usage conditions.
+ * Do ":help credits" in Vim to see a list of people who contributed.
+ * See README.txt for an overview of the Vim source code.
+ */
+
+/*
+ * puls_pl.c: Provider that lists the lines of a file for the Popup list
+ * (PULS). A NUL-separated file is mapped into memory and the items point
+ * into the mapping; the lines of other files are read into one buffer. See
+ * MappedFileItemProvider.
+ * NOTE: this file is included by popuplist.c
+ *
+ * Copyright © 2011 Marko Mahnič.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <sys/mman.h>
+
+/* [ooc]
+ *
+  // The lines of the file are the items. A file with NUL-separated lines (eg.
+  // from find -print0) is mapped read-only; its pages stay shared with the
+  // page cache and the lines are not copied. A file with newline-separated
+  // lines is read into one buffer where the newlines are replaced with NULs,
+  // because the matchers and the display need NUL-terminated texts.
+  class MappedFileItemProvider(ItemProvider) [mfprov, variant FEAT_POPUPLIST_FILELIST]
+  {
+    char_u*	fname;
+    char_u*	_map;	    // the mapping of a NUL-separated file
+    size_t	_map_len;
+    char_u*	_buf;	    // the text of a newline-separated file
+
+    void	init();
+    void	destroy();
+    int		map_file(char_u* fname);
+    int		_read_file(int fd, size_t len);
+    void	_release();
+    char_u*	get_title();
+  };
+*/
+
+    static void
+_mfprov_init(_self)
+    void* _self;
+    METHOD(MappedFileItemProvider, init);
+{
+    self->fname = NULL;
+    self->_map = NULL;
+    self->_map_len = 0;
+    self->_buf = NULL;
+    END_METHOD;
+}
+
+    static void
+_mfprov_destroy(_self)
+    void* _self;
+    METHOD(MappedFileItemProvider, destroy);
+{
+    /* the items point into the mapping or the buffer */
+    self->op->clear_items(self);
+    self->op->_release(self);
+    vim_free(self->fname);
+    END_DESTROY(MappedFileItemProvider);
+}
+
+    static void
+_mfprov__release(_self)
+    void* _self;
+    METHOD(MappedFileItemProvider, _release);
+{
+    if (self->_map)
+	munmap(self->_map, self->_map_len);
+    self->_map = NULL;
+    self->_map_len = 0;
+    vim_free(self->_buf);
+    self->_buf = NULL;
+    END_METHOD;
+}
+
+    static char_u*
+_mfprov_get_title(_self)
+    void* _self;
+    METHOD(MappedFileItemProvider, get_title);
+{
+    if (self->title)
+	return self->title;
+    return self->fname;
+    END_METHOD;
+}
+
+/*
+ * Read len bytes of the file into _buf and terminate them with a NUL.
+ * @returns FAIL if the buffer can't be allocated or the file can't be read.
+ */
+    static int
+_mfprov__read_file(_self, fd, len)
+    void* _self;
+    int fd;
+    size_t len;
+    METHOD(MappedFileItemProvider, _read_file);
+{
+    size_t done;
+    ssize_t n;
+
+    if ((size_t)(unsigned)(len + 1) != len + 1)
+	return FAIL;
+    self->_buf = alloc((unsigned)(len + 1));
+    if (! self->_buf)
+	return FAIL;
+    for (done = 0; done < len; done += n)
+    {
+	n = read(fd, self->_buf + done, len - done);
+	if (n <= 0)
+	    break;
+    }
+    /* the file may have been shortened */
+    self->_buf[done] = NUL;
+    self->_map_len = done;
+    return OK;
+    END_METHOD;
+}
+
+/*
+ * Load the file and create an item for every non-empty line. The item texts
+ * point into the mapping or the buffer; only a last line without a
+ * terminator in a NUL-separated file is copied. A leading "./" is excluded
+ * from filtering.
+ * @returns FAIL if the file can't be read.
+ */
+    static int
+_mfprov_map_file(_self, fname)
+    void* _self;
+    char_u* fname;
+    METHOD(MappedFileItemProvider, map_file);
+{
+    struct stat st;
+    PopupItem_T* pit;
+    char_u *text, *p, *pend, *pnext;
+    char_u sep;
+    int fd, count;
+
+    self->op->clear_items(self);
+    self->op->_release(self);
+    vim_free(self->fname);
+    self->fname = vim_strsave(fname);
+
+    fd = mch_open((char*)fname, O_RDONLY | O_EXTRA, 0);
+    if (fd < 0)
+	return FAIL;
+    if (fstat(fd, &st) < 0 || ! S_ISREG(st.st_mode))
+    {
+	close(fd);
+	return FAIL;
+    }
+    if (st.st_size == 0)
+    {
+	close(fd);
+	return OK;
+    }
+    if ((off_t)(size_t) st.st_size != st.st_size)
+    {
+	close(fd);
+	return FAIL;
+    }
+
+    p = (char_u*) mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == (char_u*) MAP_FAILED)
+    {
+	close(fd);
+	return FAIL;
+    }
+    self->_map = p;
+    self->_map_len = (size_t) st.st_size;
+
+    /* the lines are NUL-separated if there is a NUL in the first block */
+    sep = memchr(p, NUL, self->_map_len < 4096 ? self->_map_len : 4096) ? NUL : '\n';
+    if (sep == '\n')
+    {
+	/* the newlines can't be replaced in a read-only mapping */
+	munmap(self->_map, self->_map_len);
+	self->_map = NULL;
+	if (self->op->_read_file(self, fd, (size_t) st.st_size) == FAIL)
+	{
+	    close(fd);
+	    self->op->_release(self);
+	    return FAIL;
+	}
+	text = self->_buf;
+    }
+    else
+    {
+#ifdef MADV_SEQUENTIAL
+	madvise(self->_map, self->_map_len, MADV_SEQUENTIAL);
+#endif
+	text = self->_map;
+    }
+    close(fd);
+    pend = text + self->_map_len;
+
+    count = 0;
+    for (p = text; p < pend && (p = (char_u*) memchr(p, sep, pend - p)) != NULL; p++)
+	++count;
+    self->items->op->size_hint(self->items, count + 1);
+
+    for (p = text; p < pend; p = pnext)
+    {
+	pnext = (char_u*) memchr(p, sep, pend - p);
+	if (! pnext)
+	{
+	    if (self->_buf)
+	    {
+		/* the buffer is terminated */
+		pnext = pend;
+	    }
+	    else
+	    {
+		/* the last line is not terminated and the mapping can't be extended */
+		p = vim_strnsave(p, (int)(pend - p));
+		pit = p ? self->op->append_pchar_item(self, p, 0) : NULL;
+		if (! pit)
+		    vim_free(p);
+		else if (p[0] == '.' && p[1] == '/')
+		    pit->filter_start = 2;
+		break;
+	    }
+	}
+	if (sep == '\n')
+	{
+	    *pnext = NUL;
+	    if (pnext > p && pnext[-1] == '\r')
+		pnext[-1] = NUL;
+	}
+	++pnext;
+	if (*p == NUL)
+	    continue;
+
+	pit = self->op->append_pchar_item(self, p, ITEM_SHARED);
+	if (pit && p[0] == '.' && p[1] == '/')
+	    pit->filter_start = 2;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    if (self->_map)
+	madvise(self->_map, self->_map_len, MADV_NORMAL);
+#endif
+    return OK;
+    END_METHOD;
+}
@@ -244,7 +244,7 @@ _mnupr__list_items_r(_self, menu, selected, count, level)
 				pm->dname);
 		    }
 		}
-		pit = self->op->append_pchar_item(self, vim_strsave(IObuff), !ITEM_SHARED);
+		pit = self->op->append_pchar_item(self, IObuff, ITEM_ARENA);
 		if (pit)
 		{
 		    pit->data = (void*)pm;
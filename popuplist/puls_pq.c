@@ -169,7 +169,7 @@ _qfxpr_get_display_text(_self, item)
     PopupItem_T* pit;
     qfline_T  *pqerr;
     int len;
-    pit = self->items->op->get_item(self->items, item);
+    pit = sgarr_get_item(self->items, item);
     if (! pit)
 	return NULL;
 
@@ -223,7 +223,7 @@ _qfxpr_list_items(_self)
 		/* bufname will be deleted when the item is deleted (!ITEM_SHARED) */
 		pit = self->op->append_pchar_item(self, bufname, !ITEM_SHARED);
 	    else
-		pit = self->op->append_pchar_item(self, vim_strsave(VSTR("<unknown file>")), !ITEM_SHARED);
+		pit = self->op->append_pchar_item(self, VSTR("<unknown file>"), ITEM_ARENA);
 	    if (pit)
 		pit->flags |= ITEM_TITLE;
 	}
@@ -32,14 +32,21 @@
   typedef int (*ItemMatcher_Fn)(void* _self, void* item);
 
   // Comparator with double interface: either use fn_compare+extra or reimplement compare().
+  // A comparator that can also describe the order with keys reimplements
+  // get_key() and sets key_words; the arrays are then sorted by the keys.
   class ItemComparator [icmprtr]
   {
     ItemComparator_Fn fn_compare;
     void* extra;      // optional extra data
     int   reverse;
+    int   key_words;  // the number of 32-bit words in a key; 0 - no keys
     void  init();
     // void  destroy();
     int   compare(void* a, void* b);
+    // Write the key of the item, the most significant word first. Sorting
+    // the keys must give the same order as a stable sort with compare().
+    // @returns FAIL if the item can't be described with a key.
+    int   get_key(void* item, unsigned int* key);
   };
 
   // Matcher with double interface: either use fn_match+extra or reimplement match().
@@ -61,6 +68,7 @@ _icmprtr_init(_self)
     self->fn_compare = NULL;
     self->reverse = 0;
     self->extra = NULL;
+    self->key_words = 0;
     END_METHOD;
 }
 
@@ -79,6 +87,17 @@ _icmprtr_compare(_self, a, b)
     END_METHOD;
 }
 
+    static int
+_icmprtr_get_key(_self, item, key)
+    void* _self;
+    void* item;
+    unsigned int* key;
+    METHOD(ItemComparator, get_key);
+{
+    return FAIL;
+    END_METHOD;
+}
+
     static void
 _imtchr_init(_self)
     void* _self;
@@ -400,17 +419,23 @@ _dicti_next(_self)
   // A compromise between a list and a grow-array.  An array of items with
   // identical size.  New segments are added to grow the array.  No
   // reallocation is done for the existing items and their addresses remain
-  // fixed.
+  // fixed.  A segment holds a power-of-two number of items so that an item is
+  // found with a shift and a mask.
+  const SGARR_SEGMENT_SIZE = 1024;	      // default segment size in bytes
   const SGARR_MIN_SEGMENT_ITEM_COUNT = 16;
-  class SegmentedGrowArray [sgarr]
+  const SGARR_MAX_SEGMENT_ITEM_COUNT = 65536;
+  const SGARR_HINT_SEGMENT_COUNT = 256;	      // the number of segments for size_hint()
+  const SGARR_MIN_RADIX_SORT_ITEMS = 256;
+  const SGARR_MERGE_RUN_LEN = 16;
+  class SegmentedGrowArray [sgarr, final]
   {
-    // TODO: make all the fields 'private' and add a function to configure the array
-    //    configure(item_size[bytes], preferred_segment_size[bytes], fn_destroy);
-    // TODO: A segment should contain at least SGARR_MIN_SEGMENT_ITEM_COUNT items.
+    // TODO: make all the fields 'private'
     Destroy_Fn fn_destroy;      // a function that will destroy each item
     int	    item_size;		// size of every item
     int	    len;		// actual number of items used
-    int	    segment_len;	// number of items in a segment
+    int	    segment_len;	// number of items in a segment, a power of 2; 0 - not set
+    int	    segment_shift;	// log2(segment_len)
+    int	    segment_mask;	// segment_len - 1
     int	    index_size;		// number of segment pointers (some may be unused)
     int	    index_len;		// number of segments allocated
     void**  index;
@@ -420,10 +445,20 @@ _dicti_next(_self)
     void    clear_contents();	// clears the items in the array, but keeps the space
     void    truncate();		// frees the unused blocks allocated for the items
     int	    grow(int count);
+    // The segment size can be changed only while no segments are allocated.
+    int	    set_segment_len(int count);
+    void    size_hint(int count);	// the array will hold about count items
+    void    _init_segments();
     void*   get_new_item();
     void*   get_item(int index);
+    // The sorts are stable. A radix sort is used if cmp implements get_key.
     void    sort(ItemComparator* cmp);
-    void    _qsort(int low, int high, ItemComparator* cmp);
+    void    sort_range(int low, int high, ItemComparator* cmp);
+    // sort only the first count items; the others keep their relative order
+    void    partial_sort(int count, ItemComparator* cmp);
+    int	    _radix_sort(int low, int high, ItemComparator* cmp);
+    void    _merge_sort(int low, int high, ItemComparator* cmp);
+    void    _insertion_sort(int low, int high, ItemComparator* cmp);
   };
 */
 
@@ -439,9 +474,18 @@ _sgarr_init(_self)
     self->index_size = 0;
     self->index_len = 0;
     self->segment_len = 0;
+    self->segment_shift = 0;
+    self->segment_mask = 0;
     END_METHOD;
 }
 
+/*
+ * The item at index; the index must be valid.
+ */
+#define SGARR_ITEM_AT(sga, i) \
+    ((void*)((char*)(sga)->index[(i) >> (sga)->segment_shift] \
+	+ ((i) & (sga)->segment_mask) * (sga)->item_size))
+
     static void
 _sgarr_clear_contents(_self)
     void* _self;
@@ -486,7 +530,6 @@ _sgarr_clear(_self)
     self->index = NULL;
     self->index_size = 0;
     self->index_len = 0;
-    self->segment_len = 0;
     END_METHOD;
 }
 
@@ -503,10 +546,7 @@ _sgarr_truncate(_self)
 	return;
     }
 
-    if (self->len < 1 && self->segment_len < 1)
-	self->segment_len = 1024 / self->item_size;
-
-    req_idxlen = (self->len + self->segment_len - 1) / self->segment_len;
+    req_idxlen = (self->len + self->segment_mask) >> self->segment_shift;
     while (self->index_len > req_idxlen)
     {
 	--self->index_len;
@@ -537,10 +577,10 @@ _sgarr_grow(_self, count)
     if (count < 0)
 	return FAIL;
 
-    if (self->len < 1 && self->segment_len < 1)
-	self->segment_len = 1024 / self->item_size;
+    if (self->segment_len < 1)
+	self->op->_init_segments(self);
 
-    size = self->index_len * self->segment_len;
+    size = self->index_len << self->segment_shift;
     newlen = self->len + count;
     if (newlen <= size)
     {
@@ -548,7 +588,7 @@ _sgarr_grow(_self, count)
 	return OK;
     }
 
-    new_idxlen = (newlen + self->segment_len - 1) / self->segment_len;
+    new_idxlen = (newlen + self->segment_mask) >> self->segment_shift;
     if (new_idxlen > self->index_size)
     {
 	/* reallocate the index */
@@ -564,7 +604,7 @@ _sgarr_grow(_self, count)
     /* allocate the necessary segments */
     while (self->index_len < new_idxlen)
     {
-	pseg = (void*) alloc(1024);
+	pseg = (void*) alloc(self->segment_len * self->item_size);
 	if (! pseg)
 	    return FAIL;
 	self->index[self->index_len] = pseg;
@@ -576,20 +616,73 @@ _sgarr_grow(_self, count)
     END_METHOD;
 }
 
+/*
+ * Set the number of items in a segment. The count is rounded up to a power
+ * of 2 between SGARR_MIN_SEGMENT_ITEM_COUNT and SGARR_MAX_SEGMENT_ITEM_COUNT.
+ * @returns FAIL if the array already has segments.
+ */
+    static int
+_sgarr_set_segment_len(_self, count)
+    void* _self;
+    int count;
+    METHOD(SegmentedGrowArray, set_segment_len);
+{
+    int shift;
+    if (self->index_len > 0)
+	return FAIL;
+
+    shift = 0;
+    while ((1 << shift) < SGARR_MIN_SEGMENT_ITEM_COUNT)
+	++shift;
+    while ((1 << shift) < count && (1 << shift) < SGARR_MAX_SEGMENT_ITEM_COUNT)
+	++shift;
+
+    self->segment_shift = shift;
+    self->segment_len = 1 << shift;
+    self->segment_mask = self->segment_len - 1;
+    return OK;
+    END_METHOD;
+}
+
+/*
+ * Use bigger segments for large arrays so that the index stays short. Only
+ * an array without segments is changed.
+ */
+    static void
+_sgarr_size_hint(_self, count)
+    void* _self;
+    int count;
+    METHOD(SegmentedGrowArray, size_hint);
+{
+    int seglen;
+    if (self->index_len > 0 || self->item_size < 1)
+	return;
+
+    seglen = SGARR_SEGMENT_SIZE / self->item_size;
+    if (count / SGARR_HINT_SEGMENT_COUNT > seglen)
+	seglen = count / SGARR_HINT_SEGMENT_COUNT;
+    self->op->set_segment_len(self, seglen);
+    END_METHOD;
+}
+
+    static void
+_sgarr__init_segments(_self)
+    void* _self;
+    METHOD(SegmentedGrowArray, _init_segments);
+{
+    self->op->set_segment_len(self, (SGARR_SEGMENT_SIZE + self->item_size - 1) / self->item_size);
+    END_METHOD;
+}
+
     static void*
 _sgarr_get_new_item(_self)
     void* _self;
     METHOD(SegmentedGrowArray, get_new_item);
 {
-    void* pseg;
-    int ii;
     if (self->op->grow(self, 1) != OK)
 	return NULL;
-    ii = self->len - 1;
-    pseg = self->index[ii / self->segment_len];
-    ii = ii % self->segment_len;
 
-    return (void*)((char*)pseg + ii * self->item_size);
+    return SGARR_ITEM_AT(self, self->len - 1);
     END_METHOD;
 }
 
@@ -599,16 +692,10 @@ _sgarr_get_item(_self, index)
     int index;
     METHOD(SegmentedGrowArray, get_item);
 {
-    void* pseg;
-    int ii;
     if (! self->index || index < 0 || index >= self->len)
 	return NULL;
-    pseg = self->index[index / self->segment_len];
-    if (!pseg)
-	return NULL;
-    ii = index % self->segment_len;
 
-    return (void*)((char*)pseg + ii * self->item_size);
+    return SGARR_ITEM_AT(self, index);
     END_METHOD;
 }
 
@@ -618,207 +705,413 @@ _sgarr_sort(_self, cmp)
     ItemComparator_T* cmp;
     METHOD(SegmentedGrowArray, sort);
 {
-    if (self->len > 1)
-	self->op->_qsort(self, 0, self->len-1, cmp);
+    self->op->sort_range(self, 0, self->len-1, cmp);
     END_METHOD;
 }
 
-/* FIXME: if cmp doesn't give consistent results (is not a well-ordering), _qsort will crash.
- * Example: Because of a bug in _flcmpttsc_compare a comparison was done
- * between filter_parent_score and filter_score. This caused the stack to grow
- * to 7k items and _qsort crashed. */
     static void
-_sgarr__qsort (_self, low, high, cmp)
+_sgarr_sort_range(_self, low, high, cmp)
     void* _self;
     int low;
     int high;
     ItemComparator_T* cmp;
-    METHOD(SegmentedGrowArray, _qsort);
+    METHOD(SegmentedGrowArray, sort_range);
 {
-    typedef struct _stackitem_ {
-	int low;
-	int high;
-	int l;
-	int r;
-	int todo;
-    } StackItem_T;
-    StackItem_T* stack;
-    StackItem_T* ps;
-    int stackitem;
-    int item_size, l, r, mid, ni, select;
-    void *pl, *pr, *pmid;
-    char *tmp, *pivot;
-    int i, j, step; /* shell sort */
-
-#define QS_PART	    0x01
-#define QS_LEFT	    0x02
-#define QS_RIGHT    0x04
-#define QS_SIMPLE_SIZE 16
-#define QS_STACK_SIZE  64
-#define QS_PUSH(ilow, ihigh) { \
-    ++stackitem; \
-    stack[stackitem].low = ilow; \
-    stack[stackitem].high = ihigh; \
-    stack[stackitem].todo = 0xff; \
-    }
-#define QS_POP() --stackitem
-#define QS_TOP() stack[stackitem]
-#define QS_CALL_SSORT(ilow, ihigh, iret) { \
-    l = ilow; /* ssret = iret; r = ihigh; ni = r - l + 1; */ \
-    goto simple_sort; \
+    if (low < 0)
+	low = 0;
+    if (high >= self->len)
+	high = self->len - 1;
+    if (high <= low)
+	return;
+
+    if (cmp->key_words > 0 && high - low + 1 >= SGARR_MIN_RADIX_SORT_ITEMS
+	    && self->op->_radix_sort(self, low, high, cmp) == OK)
+	return;
+
+    self->op->_merge_sort(self, low, high, cmp);
+    END_METHOD;
+}
+
+/* Item at position a comes after item at position b in a stable sort. */
+#define SGARR_WORSE(sga, a, b) \
+    (_heap_compare(sga, a, b, cmp) > 0)
+
+    static int
+_heap_compare(sga, a, b, cmp)
+    SegmentedGrowArray_T* sga;
+    int a;
+    int b;
+    ItemComparator_T* cmp;
+{
+    int rv = cmp->op->compare(cmp, sga->op->get_item(sga, a), sga->op->get_item(sga, b));
+    if (rv == 0)
+	rv = a - b;
+    return rv;
+}
+
+/*
+ * Put value into a heap of item positions, starting at the root. The worst
+ * item is at the root of the heap.
+ */
+    static void
+_heap_sift_down(sga, heap, size, value, cmp)
+    SegmentedGrowArray_T* sga;
+    int* heap;
+    int size;
+    int value;
+    ItemComparator_T* cmp;
+{
+    int parent, child;
+    parent = 0;
+    while ((child = 2 * parent + 1) < size)
+    {
+	if (child + 1 < size && SGARR_WORSE(sga, heap[child + 1], heap[child]))
+	    ++child;
+	if (! SGARR_WORSE(sga, heap[child], value))
+	    break;
+	heap[parent] = heap[child];
+	parent = child;
     }
+    heap[parent] = value;
+}
 
-    if (high <= low)
-       	return;
+    static int
+_compare_int(a, b)
+    const void* a;
+    const void* b;
+{
+    return *(int*)a - *(int*)b;
+}
 
-    item_size = self->item_size;
-    tmp = (void*) alloc(item_size);
-    pivot = (void*) alloc(item_size);
-    stack = (StackItem_T*) alloc(sizeof(StackItem_T) * QS_STACK_SIZE);
-    stackitem = -1;
-    QS_PUSH(low, high);
+/*
+ * Move the count items that are first in the order of cmp to the start of the
+ * array and sort them. The other items keep their relative order; they can be
+ * sorted later with sort_range(count, len-1, cmp). The best items are selected
+ * with a heap of count item positions in O(len * log(count)).
+ */
+    static void
+_sgarr_partial_sort(_self, count, cmp)
+    void* _self;
+    int count;
+    ItemComparator_T* cmp;
+    METHOD(SegmentedGrowArray, partial_sort);
+{
+    int *heap;
+    char *buf;
+    int i, n, w, child, parent, last, item_size;
 
-    while(stackitem >= 0)
+    if (count >= self->len)
     {
-	ps = &QS_TOP();
+	self->op->sort(self, cmp);
+	return;
+    }
+    if (count < 1)
+	return;
 
-	if (ps->todo & QS_PART)
+    item_size = self->item_size;
+    heap = (int*) alloc(count * sizeof(int));
+    buf = (char*) alloc(count * item_size);
+    if (! heap || ! buf)
+    {
+	vim_free(heap);
+	vim_free(buf);
+	self->op->sort(self, cmp);
+	return;
+    }
+
+    /* select the best items */
+    n = 0;
+    for (i = 0; i < self->len; i++)
+    {
+	if (n < count)
 	{
-	    /*LOG(("qs %2d: PART %3d - %3d", stackitem, ps->low, ps->high));*/
-	    ps->todo &= ~QS_PART;
-	    l = ps->low;
-	    r = ps->high;
-	    mid = (l+r) / 2;
-	    pmid = self->op->get_item(self, mid);
-	    memcpy(pivot, pmid, item_size);
-
-	    while (l < r)
+	    child = n++;
+	    while (child > 0)
 	    {
-		pl = self->op->get_item(self, l);
-		while (cmp->op->compare(cmp, pl, pivot) < 0)
-		{
-		    ++l;
-		    pl = self->op->get_item(self, l);
-		}
-		pr = self->op->get_item(self, r);
-		while (cmp->op->compare(cmp, pivot, pr) < 0)
-		{
-		    --r;
-		    pr = self->op->get_item(self, r);
-		}
-		if (l <= r)
-		{
-		    if (l != r)
-		    {
-			memcpy(tmp, pl, item_size);
-			memcpy(pl, pr, item_size);
-			memcpy(pr, tmp, item_size);
-		    }
-		    ++l;
-		    --r;
-		}
+		parent = (child - 1) / 2;
+		if (! SGARR_WORSE(self, i, heap[parent]))
+		    break;
+		heap[child] = heap[parent];
+		child = parent;
 	    }
-	    ps->l = l;
-	    ps->r = r;
+	    heap[child] = i;
 	}
+	else if (SGARR_WORSE(self, heap[0], i))
+	    _heap_sift_down(self, heap, n, i, cmp);
+    }
 
-	select = ps->todo & (QS_LEFT | QS_RIGHT);
-	if (select == (QS_LEFT | QS_RIGHT))
+    /* sort the heap; the worst item goes to the end */
+    for (n = count; n > 1; )
+    {
+	last = heap[n - 1];
+	heap[--n] = heap[0];
+	_heap_sift_down(self, heap, n, last, cmp);
+    }
+    for (i = 0; i < count; i++)
+	memcpy(buf + i * item_size, sgarr_get_item(self, heap[i]), item_size);
+
+    /* move the other items to the end of the array, skipping the best ones */
+    qsort((void*)heap, (size_t)count, sizeof(int), _compare_int);
+    w = self->len - 1;
+    n = count - 1;
+    for (i = self->len - 1; i >= 0; i--)
+    {
+	if (n >= 0 && heap[n] == i)
 	{
-	    /* select the smaller interval */
-	    if (ps->r - ps->low < ps->high - ps->l)
-		select = QS_LEFT;
-	    else
-		select = QS_RIGHT;
+	    --n;
+	    continue;
 	}
-	else if (select && stackitem > 0)
+	if (i != w)
+	    memcpy(sgarr_get_item(self, w), sgarr_get_item(self, i), item_size);
+	--w;
+    }
+
+    for (i = 0; i < count; i++)
+	memcpy(sgarr_get_item(self, i), buf + i * item_size, item_size);
+
+    vim_free(heap);
+    vim_free(buf);
+    END_METHOD;
+}
+#undef SGARR_WORSE
+
+/*
+ * Sort the items with an LSD radix sort on the keys from cmp->get_key. The
+ * records with the key and the position of an item are sorted one byte at a
+ * time; the bytes that are equal in all the keys are skipped. The items are
+ * moved only once, at the end.
+ * @returns FAIL if a key could not be created or memory could not be
+ * allocated; the items are not changed then.
+ */
+    static int
+_sgarr__radix_sort(_self, low, high, cmp)
+    void* _self;
+    int low;
+    int high;
+    ItemComparator_T* cmp;
+    METHOD(SegmentedGrowArray, _radix_sort);
+{
+    unsigned int *recs, *tmp, *swap, *pr;
+    int *counts, *pc;
+    char *buf;
+    int n, rec_len, key_bytes, item_size, b, w, shift, i, v, sum, t, ok;
+
+    n = high - low + 1;
+    if (n < 2)
+	return OK;
+    if (cmp->key_words < 1)
+	return FAIL;
+
+    rec_len = cmp->key_words + 1; /* the key and the position */
+    key_bytes = cmp->key_words * 4;
+    item_size = self->item_size;
+    recs = (unsigned int*) alloc(n * rec_len * sizeof(unsigned int));
+    tmp = (unsigned int*) alloc(n * rec_len * sizeof(unsigned int));
+    counts = (int*) alloc(key_bytes * 256 * sizeof(int));
+    buf = (char*) alloc(n * item_size);
+    ok = recs && tmp && counts && buf;
+    if (ok)
+    {
+	vim_memset(counts, 0, key_bytes * 256 * sizeof(int));
+	for (i = 0, pr = recs; i < n; i++, pr += rec_len)
 	{
-	    /* The smaller interval has been sorted. If the parent has both
-	     * intervals 'done', then when the remaining (larger) interval is
-	     * sorted, the parent will also be sorted. We can thus replace the
-	     * parent info with current info on the stack. In fact we can
-	     * replace all such consequtive parents. */
-	    i = stackitem;
-	    while (i > 0 && (stack[i-1].todo & (QS_LEFT | QS_RIGHT)) == 0)
-		i--;
-	    if (i != stackitem)
+	    if (cmp->op->get_key(cmp, sgarr_get_item(self, low + i), pr) != OK)
 	    {
-		stack[i] = stack[stackitem];
-		stackitem = i;
-		ps = &QS_TOP();
+		ok = 0;
+		break;
 	    }
+	    pr[rec_len - 1] = i;
+	    /* byte b is in word w; the last word is the least significant */
+	    for (b = 0; b < key_bytes; b++)
+		++counts[b * 256 + ((pr[cmp->key_words - 1 - b / 4] >> ((b % 4) * 8)) & 0xff)];
+	}
+    }
+    if (! ok)
+    {
+	vim_free(recs);
+	vim_free(tmp);
+	vim_free(counts);
+	vim_free(buf);
+	return FAIL;
+    }
+
+    for (b = 0; b < key_bytes; b++)
+    {
+	pc = counts + b * 256;
+	w = cmp->key_words - 1 - b / 4;
+	shift = (b % 4) * 8;
+	if (pc[(recs[w] >> shift) & 0xff] == n)
+	    continue; /* all the keys have the same byte */
+
+	sum = 0;
+	for (v = 0; v < 256; v++)
+	{
+	    t = pc[v];
+	    pc[v] = sum;
+	    sum += t;
+	}
+	for (i = 0, pr = recs; i < n; i++, pr += rec_len)
+	{
+	    v = (pr[w] >> shift) & 0xff;
+	    memcpy(tmp + pc[v] * rec_len, pr, rec_len * sizeof(unsigned int));
+	    ++pc[v];
 	}
+	swap = recs;
+	recs = tmp;
+	tmp = swap;
+    }
+
+    for (i = 0, pr = recs; i < n; i++, pr += rec_len)
+	memcpy(buf + i * item_size, sgarr_get_item(self, low + pr[rec_len - 1]), item_size);
+    for (i = 0; i < n; i++)
+	memcpy(sgarr_get_item(self, low + i), buf + i * item_size, item_size);
+
+    vim_free(recs);
+    vim_free(tmp);
+    vim_free(counts);
+    vim_free(buf);
+    return OK;
+    END_METHOD;
+}
 
-	if (select == QS_LEFT)
+/*
+ * A stable bottom-up merge sort on a copy of the items. Runs of
+ * SGARR_MERGE_RUN_LEN items are sorted with insertion sort first. A
+ * comparator that is not consistent produces a wrong order, but the sort
+ * always terminates.
+ */
+    static void
+_sgarr__merge_sort(_self, low, high, cmp)
+    void* _self;
+    int low;
+    int high;
+    ItemComparator_T* cmp;
+    METHOD(SegmentedGrowArray, _merge_sort);
+{
+    char *src, *dst, *swap, *item;
+    int n, item_size, i, j, k, width, start, mid, end;
+
+    n = high - low + 1;
+    if (n < 2)
+	return;
+
+    item_size = self->item_size;
+    src = (char*) alloc(n * item_size);
+    dst = (char*) alloc(n * item_size);
+    if (! src || ! dst)
+    {
+	/* out of memory; sort the items in place */
+	vim_free(src);
+	vim_free(dst);
+	self->op->_insertion_sort(self, low, high, cmp);
+	return;
+    }
+
+    for (i = 0; i < n; i++)
+	memcpy(src + i * item_size, sgarr_get_item(self, low + i), item_size);
+
+#define SGARR_ITEM(buf, i) ((buf) + (i) * item_size)
+    /* insertion sort; the first item in dst is the temporary item */
+    item = dst;
+    for (start = 0; start < n; start += SGARR_MERGE_RUN_LEN)
+    {
+	end = start + SGARR_MERGE_RUN_LEN;
+	if (end > n)
+	    end = n;
+	for (i = start + 1; i < end; i++)
 	{
-	    /*LOG(("qs %2d: LEFT %3d - %3d", stackitem, ps->low, ps->high));*/
-	    ps->todo &= (~QS_LEFT & 0xff);
-	    ni = ps->r - ps->low + 1;
-	    if (ni > 1)
+	    if (cmp->op->compare(cmp, SGARR_ITEM(src, i - 1), SGARR_ITEM(src, i)) <= 0)
+		continue;
+	    memcpy(item, SGARR_ITEM(src, i), item_size);
+	    j = i;
+	    while (j > start && cmp->op->compare(cmp, SGARR_ITEM(src, j - 1), item) > 0)
 	    {
-		if (ni > QS_SIMPLE_SIZE)
-		{
-		    QS_PUSH(ps->low, ps->r);
-		}
-		else 
-		    QS_CALL_SSORT(ps->low, ps->r, 1);
+		memcpy(SGARR_ITEM(src, j), SGARR_ITEM(src, j - 1), item_size);
+		--j;
 	    }
+	    memcpy(SGARR_ITEM(src, j), item, item_size);
 	}
-	else if (select == QS_RIGHT)
+    }
+
+    for (width = SGARR_MERGE_RUN_LEN; width < n; width *= 2)
+    {
+	for (start = 0; start < n; start += 2 * width)
 	{
-	    /*LOG(("qs %2d: RGHT %3d - %3d", stackitem, ps->low, ps->high));*/
-	    ps->todo &= (~QS_RIGHT & 0xff);
-	    ni = ps->high - ps->l + 1;
-	    if (ni > 1)
+	    mid = start + width;
+	    if (mid > n)
+		mid = n;
+	    end = start + 2 * width;
+	    if (end > n)
+		end = n;
+	    if (mid >= end
+		    || cmp->op->compare(cmp, SGARR_ITEM(src, mid - 1), SGARR_ITEM(src, mid)) <= 0)
 	    {
-		if (ni > QS_SIMPLE_SIZE)
-		{
-		    QS_PUSH(ps->l, ps->high);
-		}
+		/* already in order */
+		memcpy(SGARR_ITEM(dst, start), SGARR_ITEM(src, start), (end - start) * item_size);
+		continue;
+	    }
+	    i = start;
+	    j = mid;
+	    k = start;
+	    while (i < mid && j < end)
+	    {
+		/* take the left item when they are equal to keep the order */
+		if (cmp->op->compare(cmp, SGARR_ITEM(src, j), SGARR_ITEM(src, i)) < 0)
+		    memcpy(SGARR_ITEM(dst, k++), SGARR_ITEM(src, j++), item_size);
 		else
-		    QS_CALL_SSORT(ps->l, ps->high, 2);
+		    memcpy(SGARR_ITEM(dst, k++), SGARR_ITEM(src, i++), item_size);
 	    }
+	    if (i < mid)
+		memcpy(SGARR_ITEM(dst, k), SGARR_ITEM(src, i), (mid - i) * item_size);
+	    else if (j < end)
+		memcpy(SGARR_ITEM(dst, k), SGARR_ITEM(src, j), (end - j) * item_size);
 	}
-	else
-	{
-	    QS_POP();
-	}
+	swap = src;
+	src = dst;
+	dst = swap;
+    }
+#undef SGARR_ITEM
+
+    for (i = 0; i < n; i++)
+	memcpy(sgarr_get_item(self, low + i), src + i * item_size, item_size);
 
-ss_ret:
-	continue;
+    vim_free(src);
+    vim_free(dst);
+    END_METHOD;
+}
+
+/*
+ * A stable insertion sort that needs no memory. The items are moved with
+ * swaps of adjacent items, so it is used only when the buffers for the merge
+ * sort can't be allocated.
+ */
+    static void
+_sgarr__insertion_sort(_self, low, high, cmp)
+    void* _self;
+    int low;
+    int high;
+    ItemComparator_T* cmp;
+    METHOD(SegmentedGrowArray, _insertion_sort);
+{
+    char *pa, *pb, c;
+    int i, j, k;
 
-simple_sort: /* 'params': ni, l */
-	/* shell sort */
-	/*LOG(("qs %2d: SHEL %3d - %3d", stackitem, l, l+ni-1));*/
-	step = (ni * 5 + 5) / 10; /* round(ni/2) */
-	while (step > 0)
+    for (i = low + 1; i <= high; i++)
+    {
+	for (j = i; j > low; j--)
 	{
-	    for (i = step; i < ni; i++)
+	    pa = (char*) sgarr_get_item(self, j - 1);
+	    pb = (char*) sgarr_get_item(self, j);
+	    if (cmp->op->compare(cmp, pa, pb) <= 0)
+		break;
+	    for (k = 0; k < self->item_size; k++)
 	    {
-		pmid = self->op->get_item(self, l+i);  /* item to move */
-		pr = pmid; /* insertion point */
-		memcpy(tmp, pmid, item_size); 
-		j = i;
-		pl = self->op->get_item(self, l+j-step);
-		while (cmp->op->compare(cmp, pl, tmp) > 0)
-		{
-		    memcpy(pr, pl, item_size);
-		    pr = pl;
-		    j -= step;
-		    if (j >= step)
-			pl = self->op->get_item(self, l+j-step);
-		    else
-			break;
-		}
-		memcpy(pr, tmp, item_size);
+		c = pa[k];
+		pa[k] = pb[k];
+		pb[k] = c;
 	    }
-	    step = (step * 10 + 11) / 22; /* round(step/2.2) */
 	}
-	goto ss_ret;
     }
-    vim_free(tmp);
-    vim_free(pivot);
-    vim_free(stack);
     END_METHOD;
 }
 
@@ -877,17 +1170,146 @@ _itsgarr_next(_self)
     void* _self;
     METHOD(SegmentedArrayIterator, next);
 {
-    void* pseg;
     if (!self->array || !self->array->index || self->iitem >= self->array->len - 1)
 	return NULL;
 
     ++self->iitem;
-    pseg = self->array->index[self->iitem / self->array->segment_len];
-    if (!pseg)
+    return SGARR_ITEM_AT(self->array, self->iitem);
+    END_METHOD;
+}
+
+/* [ooc]
+ *
+  // Allocates many small strings in big blocks. The strings can't be freed
+  // one by one; clear() frees all of them at once. Each block starts with a
+  // pointer to the previous block.
+  const STRAR_BLOCK_SIZE = 16384;
+  const STRAR_BLOCK_HEADER = sizeof(char_u*);
+  class StringArena [strar, final]
+  {
+    char_u* _blocks;	// the current block
+    int	    _used;	// the bytes used in the current block
+    int	    _size;	// the size of the current block
+    void    init();
+    void    destroy();
+    void    clear();	// free all the strings; the current block is kept
+    char_u* save(char_u* text);
+    char_u* save_len(char_u* text, int len);
+  };
+*/
+
+    static void
+_strar_init(_self)
+    void* _self;
+    METHOD(StringArena, init);
+{
+    self->_blocks = NULL;
+    self->_used = 0;
+    self->_size = 0;
+    END_METHOD;
+}
+
+    static void
+_strar_destroy(_self)
+    void* _self;
+    METHOD(StringArena, destroy);
+{
+    char_u* next;
+    while (self->_blocks)
+    {
+	next = *(char_u**) self->_blocks;
+	vim_free(self->_blocks);
+	self->_blocks = next;
+    }
+    END_DESTROY(StringArena);
+}
+
+    static void
+_strar_clear(_self)
+    void* _self;
+    METHOD(StringArena, clear);
+{
+    char_u *pblk, *next;
+    if (! self->_blocks)
+	return;
+
+    pblk = *(char_u**) self->_blocks;
+    while (pblk)
+    {
+	next = *(char_u**) pblk;
+	vim_free(pblk);
+	pblk = next;
+    }
+    *(char_u**) self->_blocks = NULL;
+    self->_used = STRAR_BLOCK_HEADER;
+    END_METHOD;
+}
+
+    static char_u*
+_strar_save(_self, text)
+    void* _self;
+    char_u* text;
+    METHOD(StringArena, save);
+{
+    if (! text)
 	return NULL;
+    return strar_save_len(self, text, (int)STRLEN(text));
+    END_METHOD;
+}
 
-    pseg = (char*)pseg + (self->iitem % self->array->segment_len) * self->array->item_size;
-    return pseg;
+/*
+ * Copy len bytes of text into the arena and add a NUL.
+ * @returns NULL if the memory could not be allocated.
+ */
+    static char_u*
+_strar_save_len(_self, text, len)
+    void* _self;
+    char_u* text;
+    int len;
+    METHOD(StringArena, save_len);
+{
+    char_u *pblk, *pstr;
+    int need = len + 1;
+
+    if (need > STRAR_BLOCK_SIZE / 4)
+    {
+	/* a long string gets its own block that is linked behind the current
+	 * block so that the rest of the current block can still be used */
+	pblk = (char_u*) alloc(STRAR_BLOCK_HEADER + need);
+	if (! pblk)
+	    return NULL;
+	if (self->_blocks)
+	{
+	    *(char_u**) pblk = *(char_u**) self->_blocks;
+	    *(char_u**) self->_blocks = pblk;
+	}
+	else
+	{
+	    *(char_u**) pblk = NULL;
+	    self->_blocks = pblk;
+	    self->_used = self->_size = STRAR_BLOCK_HEADER + need;
+	}
+	pstr = pblk + STRAR_BLOCK_HEADER;
+    }
+    else
+    {
+	if (! self->_blocks || self->_used + need > self->_size)
+	{
+	    pblk = (char_u*) alloc(STRAR_BLOCK_SIZE);
+	    if (! pblk)
+		return NULL;
+	    *(char_u**) pblk = self->_blocks;
+	    self->_blocks = pblk;
+	    self->_used = STRAR_BLOCK_HEADER;
+	    self->_size = STRAR_BLOCK_SIZE;
+	}
+	pstr = self->_blocks + self->_used;
+	self->_used += need;
+    }
+
+    memcpy(pstr, text, len);
+    pstr[len] = NUL;
+    return pstr;
     END_METHOD;
 }
 
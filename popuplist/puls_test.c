@@ -100,6 +100,162 @@ static void _test_command_t()
     _do_test_command_t_speed(hays, "qubf", count);
 }
 
+/* Compare the scores of the dynamic-programming matcher with the scores of
+ * the matcher that tries every combination of positions. */
+static int _do_test_command_t_dp(TextMatcherCmdT_T* cmdt, TextMatcherCmdTDp_T* cmdp, char_u* haystack, char_u* needle)
+{
+    ulong score_t, score_d;
+    cmdt->op->set_search_str(cmdt, needle);
+    cmdp->op->set_search_str(cmdp, needle);
+    score_t = cmdt->op->match(cmdt, haystack);
+    score_d = cmdp->op->match(cmdp, haystack);
+    if (score_t == score_d)
+	return 1;
+    LOG(("   FAIL: %s", haystack));
+    LOG(("      find: %s, score: %lu, dp score: %lu", needle, score_t, score_d));
+    return 0;
+}
+
+static void _test_command_t_dp()
+{
+    char_u haystack[64];
+    char_u needle[8];
+    char* letters = "abcab/._- 01xyz";
+    int nletters = STRLEN(letters);
+    int i, j, hlen, nlen, count, good;
+    unsigned int seed = 1;
+    TextMatcherCmdT_T* cmdt;
+    TextMatcherCmdTDp_T* cmdp;
+    char_u hays[] = "the quick brown fox jumps over a lazy dog. the quick brown fox jumps over a lazy dog.";
+    char_u path[] = "src/popuplist/popuplist_test_data/aaa_bbb/source_tree_settings.c";
+    char* needles[] = { "t", "th", "ju", "tqbf", "qubf", "tqbfjold", "qubrofo", "stst", "srcpopts", "xq" };
+    int nneedles = sizeof(needles) / sizeof(needles[0]);
+
+    LOG(("   TEST COMMAND-T DP"));
+    cmdt = new_TextMatcherCmdT();
+    cmdp = new_TextMatcherCmdTDp();
+    count = 0;
+    good = 0;
+    for (i = 0; i < nneedles; i++)
+    {
+	good += _do_test_command_t_dp(cmdt, cmdp, hays, (char_u*)needles[i]);
+	good += _do_test_command_t_dp(cmdt, cmdp, path, (char_u*)needles[i]);
+	count += 2;
+    }
+
+    /* random strings with many repeated characters */
+    for (i = 0; i < 10000; i++)
+    {
+	seed = seed * 1103515245 + 12345;
+	hlen = 1 + (seed >> 16) % (sizeof(haystack) - 1);
+	nlen = 1 + (seed >> 8) % (sizeof(needle) - 1);
+	for (j = 0; j < hlen; j++)
+	{
+	    seed = seed * 1103515245 + 12345;
+	    haystack[j] = letters[(seed >> 16) % nletters];
+	}
+	haystack[hlen] = NUL;
+	for (j = 0; j < nlen; j++)
+	{
+	    seed = seed * 1103515245 + 12345;
+	    needle[j] = letters[(seed >> 16) % 5];
+	}
+	needle[nlen] = NUL;
+	good += _do_test_command_t_dp(cmdt, cmdp, haystack, needle);
+	++count;
+    }
+    LOG(("   %4s: %d of %d scores are equal", good == count ? "ok" : "FAIL", good, count));
+
+    CLASS_DELETE(cmdt);
+    CLASS_DELETE(cmdp);
+}
+
+/* Measure the throughput of _stristr on a synthetic corpus of paths and
+ * compare it with the scalar version. */
+static void _test_stristr_speed()
+{
+    char* parts[] = { "src", "popuplist", "Include", "doc", "test_data", "Makefile",
+	"README", "puls_test", "vim73", "runtime", "plugin", "autoload" };
+    int nparts = sizeof(parts) / sizeof(parts[0]);
+    char* needles[] = { "e", "pu", "make", "TEST_DATA", "vim73/runtime", "xyz", "popuplist/readme" };
+    int nneedles = sizeof(needles) / sizeof(needles[0]);
+    int corpus_size = 20000;
+    int repeat = 20;
+    char_u** corpus;
+    int* lengths;
+    char_u buf[256];
+    int i, j, k, n, len, good, found_s, found_v;
+    long bytes;
+    unsigned int seed = 1;
+    struct timespec start, end;
+    double elapsed_s, elapsed_v;
+    char_u* ps;
+    char_u* pv;
+
+    LOG(("   TEST STRISTR SPEED"));
+    corpus = (char_u**) alloc(sizeof(char_u*) * corpus_size);
+    lengths = (int*) alloc(sizeof(int) * corpus_size);
+    bytes = 0;
+    for (i = 0; i < corpus_size; i++)
+    {
+	seed = seed * 1103515245 + 12345;
+	n = 2 + (seed >> 16) % 8;
+	len = 0;
+	for (j = 0; j < n; j++)
+	{
+	    seed = seed * 1103515245 + 12345;
+	    len += sprintf((char*)buf + len, "%s%s_%d", j ? "/" : "",
+		    parts[(seed >> 16) % nparts], (seed >> 8) % 100);
+	}
+	corpus[i] = vim_strsave(buf);
+	lengths[i] = len;
+	bytes += len;
+    }
+
+    _stristr_select();
+    good = 1;
+    for (k = 0; k < nneedles; k++)
+    {
+	found_s = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (j = 0; j < repeat; j++)
+	    for (i = 0; i < corpus_size; i++)
+		if (_stristr_from(corpus[i], STRLEN(corpus[i]), needles[k], STRLEN(needles[k]), 0))
+		    ++found_s;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed_s = timespecDiff(&end, &start) * 1e-9;
+
+	found_v = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (j = 0; j < repeat; j++)
+	    for (i = 0; i < corpus_size; i++)
+		if (_stristr(corpus[i], needles[k]))
+		    ++found_v;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed_v = timespecDiff(&end, &start) * 1e-9;
+
+	if (found_s != found_v)
+	    good = 0;
+	for (i = 0; i < corpus_size; i++)
+	{
+	    ps = _stristr_from(corpus[i], lengths[i], needles[k], STRLEN(needles[k]), 0);
+	    pv = _stristr(corpus[i], needles[k]);
+	    if (ps != pv)
+		good = 0;
+	}
+
+	LOG(("  %-16s found: %d, scalar: %.1lf MB/s, selected: %.1lf MB/s", needles[k], found_v / repeat,
+		    bytes * repeat / (elapsed_s > 0 ? elapsed_s : 1e-9) * 1e-6,
+		    bytes * repeat / (elapsed_v > 0 ? elapsed_v : 1e-9) * 1e-6));
+    }
+    LOG(("   %4s: the results of the selected and the scalar version are equal", good ? "ok" : "FAIL"));
+
+    for (i = 0; i < corpus_size; i++)
+	vim_free(corpus[i]);
+    vim_free(corpus);
+    vim_free(lengths);
+}
+
 typedef struct _test_int_list_item {
     struct _test_int_list_item* next;
     int value;
@@ -233,3 +389,136 @@ static void _test_list_helper()
 	/* TODO: test remove_all */
     }
 }
+
+/* Filter the items with a needle and then with its extension; the narrowed
+ * result must be the same as the result of a fresh filter. */
+static void _test_filter_narrowing()
+{
+    char* texts[] = { "alpha", "beta gamma", "a+b", "x|y", "delta-a" };
+    char* needles[][2] = {
+	{ "a", "al" }, { " ", " a" }, { "+", "+a" }, { "|", "|a" }, { "-", "-a" },
+	{ "a", "a -l" }, { "a", "a|x" }
+    };
+    int ntexts = sizeof(texts) / sizeof(texts[0]);
+    int nneedles = sizeof(needles) / sizeof(needles[0]);
+    TextMatcherFactory_T* factory;
+    ItemProvider_T* model;
+    ItemFilter_T* narrowed;
+    ItemFilter_T* fresh;
+    int i, k, n, good;
+
+    LOG(("   TEST FILTER NARROWING"));
+    factory = new_TextMatcherFactory();
+    model = new_ItemProvider();
+    for (i = 0; i < ntexts; i++)
+	model->op->append_pchar_item(model, (char_u*)texts[i], ITEM_SHARED);
+
+    for (k = 0; k < nneedles; k++)
+    {
+	narrowed = new_ItemFilter();
+	narrowed->model = model;
+	narrowed->op->set_matcher(narrowed, factory->op->create_matcher(factory, (char_u*)"words"));
+	narrowed->op->set_text(narrowed, (char_u*)needles[k][0]);
+	narrowed->op->filter_items(narrowed);
+	narrowed->op->set_text(narrowed, (char_u*)needles[k][1]);
+	narrowed->op->filter_items(narrowed);
+
+	fresh = new_ItemFilter();
+	fresh->model = model;
+	fresh->history_limit = 0;
+	fresh->op->set_matcher(fresh, factory->op->create_matcher(factory, (char_u*)"words"));
+	fresh->op->set_text(fresh, (char_u*)needles[k][1]);
+	fresh->op->filter_items(fresh);
+
+	n = iflt_get_item_count(fresh);
+	good = (n == iflt_get_item_count(narrowed));
+	for (i = 0; good && i < n; i++)
+	    if (iflt_get_index_of(narrowed, iflt_get_model_index(fresh, i)) < 0)
+		good = 0;
+	LOG(("   %4s: '%s' -> '%s', %d of %d items", good ? "ok" : "FAIL",
+		    needles[k][0], needles[k][1], iflt_get_item_count(narrowed), n));
+
+	CLASS_DELETE(fresh);
+	CLASS_DELETE(narrowed);
+    }
+    CLASS_DELETE(model);
+    CLASS_DELETE(factory);
+}
+
+/* The items must get the same scores with and without the folded text cache.
+ * Every matched item must have a highlighted match. */
+static void _test_fold_cache()
+{
+    char* texts[] = { "\303\211COLE/x.c", "\303\251cole/y.c", "Makefile", "README.txt",
+	"src/PopupList.c", "doc/\303\234ber.TXT" };
+    char* needles[] = { "\303\251cole", "\303\211COLE", "make", "E/", "txt", "popupl", "ber", "cole x" };
+    char* matchers[] = { "simple", "words" };
+    int ntexts = sizeof(texts) / sizeof(texts[0]);
+    int nneedles = sizeof(needles) / sizeof(needles[0]);
+    int nmatchers = sizeof(matchers) / sizeof(matchers[0]);
+    TextMatcherFactory_T* factory;
+    ItemProvider_T* models[2];
+    ItemFilter_T* filters[2];
+    PopupItem_T* pit;
+    char_u* p;
+    int i, k, m, n, good, ok, found;
+
+    LOG(("   TEST FOLD CACHE"));
+    factory = new_TextMatcherFactory();
+    for (i = 0; i < 2; i++)
+    {
+	models[i] = new_ItemProvider();
+	models[i]->fold_cache = i;
+	for (k = 0; k < ntexts; k++)
+	    models[i]->op->append_pchar_item(models[i], (char_u*)texts[k], ITEM_SHARED);
+    }
+
+    good = 1;
+    for (m = 0; m < nmatchers; m++)
+    {
+	for (k = 0; k < nneedles; k++)
+	{
+	    for (i = 0; i < 2; i++)
+	    {
+		filters[i] = new_ItemFilter();
+		filters[i]->model = models[i];
+		filters[i]->op->set_matcher(filters[i],
+			factory->op->create_matcher(factory, (char_u*)matchers[m]));
+		filters[i]->op->set_text(filters[i], (char_u*)needles[k]);
+		filters[i]->op->filter_items(filters[i]);
+	    }
+
+	    n = iflt_get_item_count(filters[1]);
+	    ok = (n == iflt_get_item_count(filters[0]));
+	    for (i = 0; i < ntexts; i++)
+	    {
+		if (models[0]->op->get_item(models[0], i)->filter_score
+			!= models[1]->op->get_item(models[1], i)->filter_score)
+		    ok = 0;
+	    }
+	    for (i = 0; i < n; i++)
+	    {
+		pit = models[1]->op->get_item(models[1], iflt_get_model_index(filters[1], i));
+		filters[1]->matcher->op->init_highlight(filters[1]->matcher, pit->text);
+		found = 0;
+		for (p = pit->text; *p && ! found; p++)
+		    found = filters[1]->matcher->op->get_match_at(filters[1]->matcher, p) > 0;
+		if (! found)
+		    ok = 0;
+	    }
+	    if (! ok)
+	    {
+		good = 0;
+		LOG(("   FAIL: %s '%s', %d items", matchers[m], needles[k], n));
+	    }
+
+	    CLASS_DELETE(filters[0]);
+	    CLASS_DELETE(filters[1]);
+	}
+    }
+    LOG(("   %4s: the scores are the same with and without the cache", good ? "ok" : "FAIL"));
+
+    CLASS_DELETE(models[0]);
+    CLASS_DELETE(models[1]);
+    CLASS_DELETE(factory);
+}
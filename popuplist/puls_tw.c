@@ -39,9 +39,9 @@
     int	    max_col;	// end column
     void    init();
     // void    destroy();
-    void    add_fixed_tab(int col);
-    int	    get_tab_size_at(int col);
-    void    set_limits(int min_col, int max_col);
+    final void add_fixed_tab(int col);
+    final int  get_tab_size_at(int col);
+    final void set_limits(int min_col, int max_col);
     // write the text and fill to max_col with fillChar if it is not NUL
     void    write_line(char_u* text, int row, int attr, int fillChar);
   };
@@ -124,6 +124,71 @@ _plwr_set_limits(_self, min_col, max_col)
     END_METHOD;
 }
 
+/*
+ * Write len bytes of text at row, col. The unprintable characters are
+ * displayed like transstr() would convert them, but the printable runs are
+ * written directly so nothing is allocated.
+ * @returns the number of screen cells written
+ */
+    static int
+_screen_puts_trans(text, len, row, col, attr)
+    char_u* text;
+    int len;
+    int row;
+    int col;
+    int attr;
+{
+    char_u *p, *end, *run, *ptrans;
+    int cells, runcells, l, c;
+
+    cells = 0;
+    runcells = 0;
+    end = text + len;
+    run = text;
+    for (p = text; p < end; p += l)
+    {
+	ptrans = NULL;
+	l = 1;
+	if (*p >= ' ' && *p < 0x7f)
+	{
+	    /* ASCII is always displayed directly */
+	    ++runcells;
+	    continue;
+	}
+#ifdef FEAT_MBYTE
+	if (has_mbyte && (l = (*mb_ptr2len)(p)) > 1)
+	{
+	    c = (*mb_ptr2char)(p);
+	    if (! vim_isprintc(c))
+		ptrans = transchar(c);
+	}
+	else
+#endif
+	{
+	    l = 1;
+	    ptrans = transchar_byte(*p);
+	    if (ptrans[0] == *p && ptrans[1] == NUL)
+		ptrans = NULL;
+	}
+	if (! ptrans)
+	{
+	    runcells += ptr2cells(p);
+	    continue;
+	}
+
+	if (p > run)
+	    screen_puts_len(run, (int)(p - run), row, col + cells, attr);
+	cells += runcells;
+	runcells = 0;
+	screen_puts_len(ptrans, (int)STRLEN(ptrans), row, col + cells, attr);
+	cells += vim_strsize(ptrans);
+	run = p + l;
+    }
+    if (end > run)
+	screen_puts_len(run, (int)(end - run), row, col + cells, attr);
+    return cells + runcells;
+}
+
 /*
  *        L         R		Border
  *        01234567890		Box column
@@ -162,7 +227,7 @@ _plwr_write_line(_self, text, row, attr, fillChar)
     for ( ; p != NULL; ADVANCE_CHAR_P(p))
     {
 	if (*p == TAB)
-	    w = self->op->get_tab_size_at(self, pwidth);
+	    w = plwr_get_tab_size_at(self, pwidth);
 	else
 	    w = ptr2cells(p);
 	pwidth += w;
@@ -185,20 +250,8 @@ _plwr_write_line(_self, text, row, attr, fillChar)
 	}
 	if (*p == NUL || *p == TAB || pwidth >= max_pwidth)
 	{
-	    /* Display the text that fits or comes before a Tab.
-	     * First convert it to printable characters. */
-	    char_u	*st;
-	    int	saved = *p;
-
-	    *p = NUL;
-	    st = transstr(s);
-	    *p = saved;
-	    if (st)
-	    {
-		screen_puts_len(st, (int)STRLEN(st), row, col, attr);
-		col += vim_strsize(st);
-		vim_free(st);
-	    }
+	    /* Display the text that fits or comes before a Tab. */
+	    col += _screen_puts_trans(s, (int)(p - s), row, col, attr);
 	    s = NULL;
 	    if (*p == TAB)
 	    {
@@ -483,16 +536,9 @@ _plhlwr__flush(_self, text_end, row, col, attr)
     int attr;
     METHOD(LineHighlightWriter, _flush);
 {
-    char_u  *st;
     *text_end = NUL;
-    st = transstr(self->_tmpbuf);
-    if (st)
-    {
-	screen_puts_len(st, (int)STRLEN(st), row, col, attr);
-	col = vim_strsize(st);
-	vim_free(st);
-    }
-    return col; /* number of columns written */
+    /* number of columns written */
+    return _screen_puts_trans(self->_tmpbuf, (int)(text_end - self->_tmpbuf), row, col, attr);
     END_METHOD;
 }
 
@@ -542,7 +588,7 @@ _plhlwr_write_line(_self, text, row, init_attr, fillChar)
 	    if (! self->highlighters)
 	    {
 		if (*p == TAB)
-		    w = self->op->get_tab_size_at(self, pwidth);
+		    w = plwr_get_tab_size_at(self, pwidth);
 		else
 		    w = ptr2cells(p);
 	    }
@@ -566,12 +612,12 @@ _plhlwr_write_line(_self, text, row, init_attr, fillChar)
 		if (w < 0)
 		{
 		    if (*p == TAB)
-			w = self->op->get_tab_size_at(self, pwidth);
+			w = plwr_get_tab_size_at(self, pwidth);
 		    else
 			w = ptr2cells(p);
 		}
 		else if (w > 0 && *p == TAB)
-		    w = self->op->get_tab_size_at(self, pwidth);
+		    w = plwr_get_tab_size_at(self, pwidth);
 
 		if (next_attr != attr)
 		{